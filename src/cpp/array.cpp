@@ -0,0 +1,420 @@
+#include "array.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <type_traits>
+#include <vector>
+
+namespace effil {
+
+namespace {
+
+typedef std::unique_lock<SharedMutex> UniqueLock;
+typedef std::shared_lock<SharedMutex> SharedLock;
+
+struct ElementTypeInfo {
+    ElementType type;
+    const char* name;
+    size_t size;
+};
+
+const ElementTypeInfo ELEMENT_TYPES[] = {
+    { ElementType::F64, "f64", sizeof(double) },
+    { ElementType::I64, "i64", sizeof(int64_t) },
+    { ElementType::F32, "f32", sizeof(float) },
+    { ElementType::U8,  "u8",  sizeof(uint8_t) }
+};
+
+const ElementTypeInfo& infoOf(ElementType type) {
+    return ELEMENT_TYPES[static_cast<size_t>(type)];
+}
+
+// Calls func with pointer to elements of their actual type
+template <typename Func>
+auto withElements(ArrayData& data, const Func& func) -> decltype(func(static_cast<double*>(nullptr))) {
+    unsigned char* buffer = data.buffer.get();
+    switch (data.type) {
+        case ElementType::F64:
+            return func(reinterpret_cast<double*>(buffer));
+        case ElementType::I64:
+            return func(reinterpret_cast<int64_t*>(buffer));
+        case ElementType::F32:
+            return func(reinterpret_cast<float*>(buffer));
+        case ElementType::U8:
+            return func(reinterpret_cast<uint8_t*>(buffer));
+    }
+    assert(false);
+    return func(reinterpret_cast<double*>(buffer));
+}
+
+// Integer types accept only integral numbers which they can represent
+bool isIntegral(lua_Number number, lua_Number min, lua_Number max) {
+    return std::floor(number) == number && number >= min && number <= max;
+}
+
+void convert(lua_State* L, int index, double& element) {
+    element = lua_tonumber(L, index);
+}
+
+void convert(lua_State* L, int index, float& element) {
+    element = static_cast<float>(lua_tonumber(L, index));
+}
+
+void convert(lua_State* L, int index, int64_t& element) {
+#if LUA_VERSION_NUM == 503
+    if (lua_isinteger(L, index)) {
+        element = static_cast<int64_t>(lua_tointeger(L, index));
+        return;
+    }
+#endif // Lua5.3
+    // 2^63 is the first double which doesn't fit
+    const lua_Number limit = -static_cast<lua_Number>(std::numeric_limits<int64_t>::min());
+    const lua_Number number = lua_tonumber(L, index);
+    REQUIRE(std::floor(number) == number && number >= -limit && number < limit)
+            << "number " << number << " has no i64 representation";
+    element = static_cast<int64_t>(number);
+}
+
+void convert(lua_State* L, int index, uint8_t& element) {
+    const lua_Number number = lua_tonumber(L, index);
+    REQUIRE(isIntegral(number, 0, 255)) << "number " << number << " has no u8 representation";
+    element = static_cast<uint8_t>(number);
+}
+
+template <typename T>
+T toElement(const sol::stack_object& value) {
+    REQUIRE(value.get_type() == sol::type::number) << "number expected, got " << luaTypename(value);
+    T element;
+    convert(value.lua_state(), value.stack_index(), element);
+    return element;
+}
+
+// Floating point results are numbers, integer ones are integers
+template <typename T>
+using ResultOf = typename std::conditional<std::is_floating_point<T>::value, lua_Number, int64_t>::type;
+
+template <typename T>
+sol::object toLua(sol::this_state state, T value) {
+    return sol::make_object(state, static_cast<ResultOf<T>>(value));
+}
+
+// Integers are summed with wrap around like in Lua 5.3, floats are summed in double precision
+template <typename T>
+using AccumulatorOf = typename std::conditional<std::is_floating_point<T>::value, double, uint64_t>::type;
+
+// Elements are reduced by LANES independent accumulators, then the accumulators are reduced.
+// Lanes don't depend on each other, so compiler turns the inner loop into SIMD instructions
+// without reordering of floating point operations it isn't allowed to do
+constexpr size_t LANES = 8;
+
+template <typename Acc, typename Op>
+Acc reduceLanes(Acc (&lanes)[LANES], Acc result, const Op& op) {
+    for (size_t k = 0; k < LANES; ++k)
+        result = op(result, lanes[k]);
+    return result;
+}
+
+template <typename Acc, typename T, typename Op>
+Acc reduce(const T* data, size_t size, Acc initial, const Op& op) {
+    Acc lanes[LANES];
+    std::fill(lanes, lanes + LANES, initial);
+    size_t i = 0;
+    for (; i + LANES <= size; i += LANES)
+        for (size_t k = 0; k < LANES; ++k)
+            lanes[k] = op(lanes[k], static_cast<Acc>(data[i + k]));
+    Acc result = reduceLanes(lanes, initial, op);
+    for (; i < size; ++i)
+        result = op(result, static_cast<Acc>(data[i]));
+    return result;
+}
+
+template <typename Acc, typename T>
+Acc dotProduct(const T* left, const T* right, size_t size) {
+    Acc lanes[LANES] = {};
+    size_t i = 0;
+    for (; i + LANES <= size; i += LANES)
+        for (size_t k = 0; k < LANES; ++k)
+            lanes[k] += static_cast<Acc>(left[i + k]) * static_cast<Acc>(right[i + k]);
+    const auto add = [](Acc a, Acc b) { return a + b; };
+    Acc result = reduceLanes(lanes, Acc(), add);
+    for (; i < size; ++i)
+        result += static_cast<Acc>(left[i]) * static_cast<Acc>(right[i]);
+    return result;
+}
+
+// Zero based position of Lua index, index must be in range [1, size]
+size_t toPosition(const sol::stack_object& key, size_t size) {
+    REQUIRE(key.get_type() == sol::type::number) << "index must be a number, got " << luaTypename(key);
+    const LUA_INDEX_TYPE index = key.as<LUA_INDEX_TYPE>();
+    REQUIRE(index >= 1 && index <= static_cast<LUA_INDEX_TYPE>(size) &&
+            static_cast<LUA_INDEX_TYPE>(static_cast<size_t>(index)) == index)
+            << "index " << index << " is out of range [1, " << size << "]";
+    return static_cast<size_t>(index) - 1;
+}
+
+// Locks arrays in order of their addresses, so pairwise operations don't deadlock each other
+class PairLock {
+public:
+    PairLock(ArrayData& target, ArrayData& source)
+            : target_(target.lock, std::defer_lock)
+            , source_(source.lock, std::defer_lock) {
+        if (&target == &source) {
+            target_.lock();
+        } else if (&target < &source) {
+            target_.lock();
+            source_.lock();
+        } else {
+            source_.lock();
+            target_.lock();
+        }
+    }
+
+private:
+    UniqueLock target_;
+    SharedLock source_;
+};
+
+} // namespace
+
+void Array::exportAPI(sol::state_view& lua) {
+    sol::usertype<Array> type("new", sol::no_constructor,
+        sol::meta_function::index,      &Array::luaIndex,
+        sol::meta_function::new_index,  &Array::luaNewIndex,
+        sol::meta_function::length,     &Array::luaLength,
+        sol::meta_function::to_string,  &Array::luaToString,
+        sol::meta_function::equal_to,   &Array::luaEq,
+        "type",     &Array::type,
+        "fill",     &Array::fill,
+        "assign",   &Array::assign,
+        "to_table", &Array::toTable,
+        "sum",      &Array::sum,
+        "min",      &Array::min,
+        "max",      &Array::max,
+        "dot",      &Array::dot
+    );
+    sol::stack::push(lua, type);
+    sol::stack::pop<sol::object>(lua);
+}
+
+void Array::initialize(const sol::stack_object& type, const sol::stack_object& size) {
+    REQUIRE(type.get_type() == sol::type::string)
+            << "bad argument #1 to 'effil.array' (string expected, got " << luaTypename(type) << ")";
+    REQUIRE(size.get_type() == sol::type::number)
+            << "bad argument #2 to 'effil.array' (number expected, got " << luaTypename(size) << ")";
+
+    const std::string typeName = type.as<std::string>();
+    const auto info = std::find_if(std::begin(ELEMENT_TYPES), std::end(ELEMENT_TYPES),
+                                   [&](const ElementTypeInfo& entry) { return typeName == entry.name; });
+    REQUIRE(info != std::end(ELEMENT_TYPES)) << "effil.array: unknown element type '" << typeName << "'";
+
+    const double count = size.as<double>();
+    REQUIRE(count >= 0 && std::floor(count) == count &&
+            count < static_cast<double>(std::numeric_limits<std::ptrdiff_t>::max() / info->size))
+            << "effil.array: invalid size = " << count;
+
+    ctx_->type = info->type;
+    ctx_->size = static_cast<size_t>(count);
+    try {
+        // elements are zero initialized
+        ctx_->buffer.reset(new unsigned char[ctx_->size * info->size]());
+    } catch (const std::bad_alloc&) {
+        throw Exception() << "effil.array: unable to allocate " << count << " elements";
+    }
+}
+
+std::string Array::type() const {
+    return infoOf(ctx_->type).name;
+}
+
+std::string Array::luaToString() {
+    std::stringstream ss;
+    ss << "effil.array: " << ctx_.get();
+    return ss.str();
+}
+
+// Every access to array in Lua gives new userdata, so arrays are compared by handle
+bool Array::luaEq(const sol::stack_object& left, const sol::stack_object& right) {
+    return left.get_type() == sol::type::userdata && left.is<Array>() &&
+           right.get_type() == sol::type::userdata && right.is<Array>() &&
+           left.as<Array>().handle() == right.as<Array>().handle();
+}
+
+// Keys which aren't methods are indices
+sol::object Array::luaIndex(const sol::stack_object& key, sol::this_state state) {
+    try {
+        if (key.get_type() != sol::type::number)
+            return sol::nil;
+        const size_t position = toPosition(key, ctx_->size);
+        SharedLock lock(ctx_->lock);
+        return withElements(*ctx_, [&](auto* elements) {
+            return toLua(state, elements[position]);
+        });
+    } RETHROW_WITH_PREFIX("effil.array");
+}
+
+void Array::luaNewIndex(const sol::stack_object& key, const sol::stack_object& value) {
+    try {
+        const size_t position = toPosition(key, ctx_->size);
+        withElements(*ctx_, [&](auto* elements) {
+            const auto element = toElement<std::remove_pointer_t<decltype(elements)>>(value);
+            UniqueLock lock(ctx_->lock);
+            elements[position] = element;
+        });
+    } RETHROW_WITH_PREFIX("effil.array");
+}
+
+Array Array::fill(const sol::stack_object& value) {
+    try {
+        withElements(*ctx_, [&](auto* elements) {
+            const auto element = toElement<std::remove_pointer_t<decltype(elements)>>(value);
+            UniqueLock lock(ctx_->lock);
+            std::fill(elements, elements + ctx_->size, element);
+        });
+        return *this;
+    } RETHROW_WITH_PREFIX("effil.array:fill");
+}
+
+// Values are sequence of Lua table or effil.array of the same type,
+// they are converted before the array is locked
+Array Array::assign(const sol::stack_object& values, const sol::stack_object& first) {
+    try {
+        const size_t offset = first.valid() ? toPosition(first, ctx_->size) : 0;
+
+        if (values.get_type() == sol::type::userdata && values.is<Array>()) {
+            Array source = values.as<Array>();
+            REQUIRE(source.ctx_->type == ctx_->type)
+                    << "can't assign " << source.type() << " elements to " << type() << " array";
+            REQUIRE(source.size() <= ctx_->size - offset)
+                    << source.size() << " elements don't fit from index " << offset + 1;
+            const size_t bytes = source.size() * infoOf(ctx_->type).size;
+            const size_t start = offset * infoOf(ctx_->type).size;
+            PairLock lock(*ctx_, *source.ctx_);
+            std::memmove(ctx_->buffer.get() + start, source.ctx_->buffer.get(), bytes);
+            return *this;
+        }
+
+        REQUIRE(values.get_type() == sol::type::table)
+                << "bad argument #1 to 'assign' (table or effil.array expected, got " << luaTypename(values) << ")";
+        lua_State* L = values.lua_state();
+        const int valuesIndex = values.stack_index();
+        withElements(*ctx_, [&](auto* elements) {
+            using Element = std::remove_pointer_t<decltype(elements)>;
+            std::vector<Element> converted;
+            for (int i = 1; ; ++i) {
+                lua_rawgeti(L, valuesIndex, i);
+                const sol::stack_object value(L, -1);
+                if (value.get_type() == sol::type::nil) {
+                    lua_pop(L, 1);
+                    break;
+                }
+                try {
+                    converted.push_back(toElement<Element>(value));
+                } catch (const Exception& err) {
+                    lua_pop(L, 1);
+                    throw Exception() << "bad value #" << i << " (" << err.what() << ")";
+                }
+                lua_pop(L, 1);
+            }
+            REQUIRE(converted.size() <= ctx_->size - offset)
+                    << converted.size() << " elements don't fit from index " << offset + 1;
+
+            UniqueLock lock(ctx_->lock);
+            std::copy(converted.begin(), converted.end(), elements + offset);
+        });
+        return *this;
+    } RETHROW_WITH_PREFIX("effil.array:assign");
+}
+
+sol::table Array::toTable(sol::this_state state, const sol::stack_object& first, const sol::stack_object& last) {
+    try {
+        if (ctx_->size == 0)
+            return sol::table::create(state.L);
+        const size_t from = first.valid() ? toPosition(first, ctx_->size) : 0;
+        const size_t to = last.valid() ? toPosition(last, ctx_->size) : ctx_->size - 1;
+        if (from > to)
+            return sol::table::create(state.L);
+
+        lua_State* L = state;
+        lua_createtable(L, static_cast<int>(to - from + 1), 0);
+        withElements(*ctx_, [&](auto* elements) {
+            SharedLock lock(ctx_->lock);
+            for (size_t i = from; i <= to; ++i) {
+                toLua(state, elements[i]).push(L);
+                lua_rawseti(L, -2, static_cast<int>(i - from + 1));
+            }
+        });
+        return sol::stack::pop<sol::table>(L);
+    } RETHROW_WITH_PREFIX("effil.array:to_table");
+}
+
+sol::object Array::sum(sol::this_state state) {
+    return withElements(*ctx_, [&](auto* elements) {
+        using Element = std::remove_pointer_t<decltype(elements)>;
+        using Acc = AccumulatorOf<Element>;
+        SharedLock lock(ctx_->lock);
+        const Acc result = reduce(elements, ctx_->size, Acc(), [](Acc a, Acc b) { return a + b; });
+        lock.unlock();
+        return toLua(state, static_cast<ResultOf<Element>>(result));
+    });
+}
+
+// Minimum and maximum of empty array are nil
+sol::object Array::min(sol::this_state state) {
+    return withElements(*ctx_, [&](auto* elements) -> sol::object {
+        using Element = std::remove_pointer_t<decltype(elements)>;
+        if (ctx_->size == 0)
+            return sol::nil;
+        SharedLock lock(ctx_->lock);
+        const Element result = reduce(elements, ctx_->size, elements[0],
+                                      [](Element a, Element b) { return b < a ? b : a; });
+        lock.unlock();
+        return toLua(state, result);
+    });
+}
+
+sol::object Array::max(sol::this_state state) {
+    return withElements(*ctx_, [&](auto* elements) -> sol::object {
+        using Element = std::remove_pointer_t<decltype(elements)>;
+        if (ctx_->size == 0)
+            return sol::nil;
+        SharedLock lock(ctx_->lock);
+        const Element result = reduce(elements, ctx_->size, elements[0],
+                                      [](Element a, Element b) { return a < b ? b : a; });
+        lock.unlock();
+        return toLua(state, result);
+    });
+}
+
+sol::object Array::dot(sol::this_state state, const sol::stack_object& other) {
+    try {
+        REQUIRE(other.get_type() == sol::type::userdata && other.is<Array>())
+                << "bad argument #1 to 'dot' (effil.array expected, got " << luaTypename(other) << ")";
+        Array right = other.as<Array>();
+        REQUIRE(right.ctx_->type == ctx_->type && right.size() == ctx_->size)
+                << "arrays must have the same type and size";
+
+        return withElements(*ctx_, [&](auto* elements) {
+            using Element = std::remove_pointer_t<decltype(elements)>;
+            using Acc = AccumulatorOf<Element>;
+            const auto* rightElements = reinterpret_cast<const Element*>(right.ctx_->buffer.get());
+
+            // shared locks of different arrays are taken in order of addresses
+            SharedLock first(std::min(ctx_.get(), right.ctx_.get())->lock);
+            SharedLock second;
+            if (ctx_ != right.ctx_)
+                second = SharedLock(std::max(ctx_.get(), right.ctx_.get())->lock);
+            const Acc result = dotProduct<Acc>(elements, rightElements, ctx_->size);
+            return toLua(state, static_cast<ResultOf<Element>>(result));
+        });
+    } RETHROW_WITH_PREFIX("effil.array:dot");
+}
+
+} // namespace effil
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "shared-mutex.h"
+#include "lua-helpers.h"
+#include "gc-data.h"
+#include "gc-object.h"
+
+#include <sol.hpp>
+
+#include <cstdint>
+#include <memory>
+
+namespace effil {
+
+enum class ElementType : uint8_t {
+    F64,
+    I64,
+    F32,
+    U8
+};
+
+class ArrayData : public GCData {
+public:
+    SharedMutex lock; // guards elements, type and size are immutable
+    ElementType type = ElementType::F64;
+    size_t size = 0;
+    std::unique_ptr<unsigned char[]> buffer;
+};
+
+// Fixed size array of numbers of one type kept in contiguous buffer.
+// Array is stored in tables and channels by reference, so elements are never copied.
+class Array : public GCObject<ArrayData> {
+public:
+    static void exportAPI(sol::state_view& lua);
+
+    size_t size() const { return ctx_->size; }
+
+    // These functions are metamethods available in Lua
+    sol::object luaIndex(const sol::stack_object& key, sol::this_state state);
+    void luaNewIndex(const sol::stack_object& key, const sol::stack_object& value);
+    size_t luaLength() const { return ctx_->size; }
+    std::string luaToString();
+    static bool luaEq(const sol::stack_object& left, const sol::stack_object& right);
+
+    // These functions are methods available in Lua
+    std::string type() const;
+    Array fill(const sol::stack_object& value);
+    Array assign(const sol::stack_object& values, const sol::stack_object& first);
+    sol::table toTable(sol::this_state state, const sol::stack_object& first, const sol::stack_object& last);
+    sol::object sum(sol::this_state state);
+    sol::object min(sol::this_state state);
+    sol::object max(sol::this_state state);
+    sol::object dot(sol::this_state state, const sol::stack_object& other);
+
+private:
+    Array() = default;
+    using GCObject<ArrayData>::GCObject;
+    void initialize(const sol::stack_object& type, const sol::stack_object& size);
+    friend class GC;
+};
+
+} // namespace effil
@@ -0,0 +1,187 @@
+#include "buffer.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+
+namespace effil {
+
+namespace {
+
+typedef std::unique_lock<SharedMutex> UniqueLock;
+typedef std::shared_lock<SharedMutex> SharedLock;
+
+// Index of byte like string.sub gets it: negative indices count from the end.
+// Result is clamped to [0, size + 1]
+int64_t toIndex(const sol::stack_object& index, int64_t defaultValue, size_t size, int argument) {
+    if (!index.valid())
+        return defaultValue;
+    REQUIRE(index.get_type() == sol::type::number)
+            << "bad argument #" << argument << " to 'sub' (number expected, got " << luaTypename(index) << ")";
+
+    const int64_t length = static_cast<int64_t>(size);
+    const lua_Number number = index.as<lua_Number>();
+    if (number < -static_cast<lua_Number>(length))
+        return 0;
+    if (number > static_cast<lua_Number>(length))
+        return length + 1;
+    const int64_t value = static_cast<int64_t>(std::floor(number));
+    return value < 0 ? length + value + 1 : value;
+}
+
+} // namespace
+
+void Buffer::exportAPI(sol::state_view& lua) {
+    sol::usertype<Buffer> type("new", sol::no_constructor,
+        sol::meta_function::length,     &Buffer::luaLength,
+        sol::meta_function::to_string,  &Buffer::luaToString,
+        sol::meta_function::equal_to,   &Buffer::luaEq,
+        "sub",      &Buffer::sub,
+        "append",   &Buffer::append,
+        "seal",     &Buffer::seal,
+        "sealed",   &Buffer::sealed,
+        "pointer",  &Buffer::pointer
+    );
+    sol::stack::push(lua, type);
+    sol::stack::pop<sol::object>(lua);
+}
+
+void Buffer::initialize(const sol::stack_object& init) {
+    if (!init.valid())
+        return;
+
+    if (init.get_type() == sol::type::string) {
+        size_t size = 0;
+        const char* data = lua_tolstring(init.lua_state(), init.stack_index(), &size);
+        appendBytes(data, size);
+    } else if (init.get_type() == sol::type::number) {
+        // allocations can't be bigger than the biggest pointer difference
+        const lua_Number capacity = init.as<lua_Number>();
+        REQUIRE(capacity >= 0 && std::floor(capacity) == capacity &&
+                capacity < static_cast<lua_Number>(std::numeric_limits<std::ptrdiff_t>::max()))
+                << "effil.buffer: invalid capacity value = " << capacity;
+        try {
+            ctx_->storage = std::make_shared<BufferStorage>(static_cast<size_t>(capacity));
+        } catch (const std::bad_alloc&) {
+            throw Exception() << "effil.buffer: unable to reserve " << capacity << " bytes";
+        }
+        ctx_->data = ctx_->storage->bytes.get();
+    } else {
+        throw Exception() << "bad argument #1 to 'effil.buffer' (string or number expected, got "
+                          << luaTypename(init) << ")";
+    }
+}
+
+// Slices share storage with their buffer and can't be appended
+void Buffer::initialize(const Bytes& slice) {
+    ctx_->storage = slice.storage;
+    ctx_->data = slice.data;
+    ctx_->size = slice.size;
+    ctx_->sealed = true;
+}
+
+Buffer::Bytes Buffer::bytes() const {
+    SharedLock lock(ctx_->lock);
+    return Bytes{ctx_->storage, ctx_->data, ctx_->size};
+}
+
+size_t Buffer::size() const {
+    SharedLock lock(ctx_->lock);
+    return ctx_->size;
+}
+
+bool Buffer::sealed() const {
+    SharedLock lock(ctx_->lock);
+    return ctx_->sealed;
+}
+
+// The only copy of bytes to Lua is made here
+sol::object Buffer::luaToString(sol::this_state state) const {
+    const Bytes current = bytes();
+    lua_pushlstring(state, current.data != nullptr ? current.data : "", current.size);
+    return sol::stack::pop<sol::object>(state);
+}
+
+// Every access to buffer in Lua gives new userdata, so buffers are compared by handle
+bool Buffer::luaEq(const sol::stack_object& left, const sol::stack_object& right) {
+    return left.get_type() == sol::type::userdata && left.is<Buffer>() &&
+           right.get_type() == sol::type::userdata && right.is<Buffer>() &&
+           left.as<Buffer>().handle() == right.as<Buffer>().handle();
+}
+
+Buffer Buffer::sub(const sol::stack_object& first, const sol::stack_object& last) const {
+    try {
+        Bytes slice = bytes();
+        const int64_t from = std::max<int64_t>(toIndex(first, 1, slice.size, 1), 1);
+        const int64_t to = std::min<int64_t>(toIndex(last, -1, slice.size, 2), slice.size);
+        if (from > to) {
+            slice.size = 0;
+        } else {
+            slice.data += from - 1;
+            slice.size = static_cast<size_t>(to - from + 1);
+        }
+        return GC::instance().create<Buffer>(slice);
+    } RETHROW_WITH_PREFIX("effil.buffer:sub");
+}
+
+Buffer Buffer::append(const sol::stack_object& data) {
+    try {
+        if (data.get_type() == sol::type::string) {
+            size_t size = 0;
+            const char* chars = lua_tolstring(data.lua_state(), data.stack_index(), &size);
+            appendBytes(chars, size);
+        } else if (data.get_type() == sol::type::userdata && data.is<Buffer>()) {
+            // bytes of source are held by the snapshot, so the source isn't locked while it's copied
+            const Bytes source = data.as<Buffer>().bytes();
+            appendBytes(source.data, source.size);
+        } else {
+            throw Exception() << "bad argument #1 to 'append' (string or effil.buffer expected, got "
+                              << luaTypename(data) << ")";
+        }
+        return *this;
+    } RETHROW_WITH_PREFIX("effil.buffer:append");
+}
+
+// Readers hold the storage they have got, so bytes are written after the end of buffer only.
+// Storage is reallocated with doubled capacity when it's full
+void Buffer::appendBytes(const char* data, size_t size) {
+    UniqueLock lock(ctx_->lock);
+    REQUIRE(!ctx_->sealed) << "buffer is sealed";
+    if (size == 0)
+        return;
+
+    const size_t required = ctx_->size + size;
+    if (!ctx_->storage || required > ctx_->storage->capacity) {
+        const size_t capacity = ctx_->storage ? std::max(required, ctx_->storage->capacity * 2) : required;
+        auto storage = std::make_shared<BufferStorage>(capacity);
+        if (ctx_->size > 0)
+            std::memcpy(storage->bytes.get(), ctx_->data, ctx_->size);
+        ctx_->storage = std::move(storage);
+        ctx_->data = ctx_->storage->bytes.get();
+    }
+    std::memcpy(ctx_->storage->bytes.get() + ctx_->size, data, size);
+    ctx_->size = required;
+}
+
+Buffer Buffer::seal() {
+    UniqueLock lock(ctx_->lock);
+    ctx_->sealed = true;
+    return *this;
+}
+
+// Sealed buffer never moves its bytes, so they can be read via FFI while buffer is alive
+void* Buffer::pointer() const {
+    try {
+        SharedLock lock(ctx_->lock);
+        REQUIRE(ctx_->sealed) << "buffer must be sealed";
+        return const_cast<char*>(ctx_->data);
+    } RETHROW_WITH_PREFIX("effil.buffer:pointer");
+}
+
+} // namespace effil
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "shared-mutex.h"
+#include "lua-helpers.h"
+#include "gc-data.h"
+#include "gc-object.h"
+
+#include <sol.hpp>
+
+#include <memory>
+
+namespace effil {
+
+// Bytes of buffer and its slices. Bytes are written once and never changed,
+// so the storage is read without locks by anyone who holds it
+struct BufferStorage {
+    explicit BufferStorage(size_t capacity)
+            : bytes(new char[capacity])
+            , capacity(capacity) {}
+
+    std::unique_ptr<char[]> bytes;
+    const size_t capacity;
+};
+
+class BufferData : public GCData {
+public:
+    SharedMutex lock; // guards fields below
+    std::shared_ptr<BufferStorage> storage;
+    const char* data = nullptr;
+    size_t size = 0;
+    bool sealed = false;
+};
+
+// Append-only byte string which is stored in tables and channels by reference.
+// Appending may move bytes to a bigger storage, slices keep the old one alive.
+class Buffer : public GCObject<BufferData> {
+public:
+    static void exportAPI(sol::state_view& lua);
+
+    size_t size() const;
+
+    // These functions are metamethods available in Lua
+    size_t luaLength() const { return size(); }
+    sol::object luaToString(sol::this_state state) const;
+    static bool luaEq(const sol::stack_object& left, const sol::stack_object& right);
+
+    // These functions are methods available in Lua
+    Buffer sub(const sol::stack_object& first, const sol::stack_object& last) const;
+    Buffer append(const sol::stack_object& data);
+    Buffer seal();
+    bool sealed() const;
+    void* pointer() const;
+
+private:
+    // Bytes of buffer at some moment, they stay valid after buffer is appended
+    struct Bytes {
+        std::shared_ptr<BufferStorage> storage;
+        const char* data;
+        size_t size;
+    };
+
+    Bytes bytes() const;
+    void appendBytes(const char* data, size_t size);
+
+    Buffer() = default;
+    using GCObject<BufferData>::GCObject;
+    void initialize(const sol::stack_object& init);
+    void initialize(const Bytes& slice);
+    friend class GC;
+};
+
+} // namespace effil
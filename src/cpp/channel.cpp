@@ -39,13 +39,13 @@ bool Channel::push(const sol::variadic_args& args) {
     for (const auto& arg : args) {
         try {
             auto obj = createStoredObject(arg.get<sol::object>());
-            ctx_->addReference(obj->gcHandle());
-            obj->releaseStrongReference();
-            array.emplace_back(obj);
+            ctx_->addReference(obj.gcHandle());
+            obj.releaseStrongReference();
+            array.emplace_back(std::move(obj));
         }
         RETHROW_WITH_PREFIX("effil.channel:push");
     }
-    ctx_->channel_.emplace(array);
+    ctx_->channel_.emplace(std::move(array));
     ctx_->cv_.notify_one();
     return true;
 }
@@ -74,10 +74,10 @@ StoredArray Channel::pop(const sol::optional<int>& duration,
         }
     }
 
-    auto ret = ctx_->channel_.front();
-    for (const auto& obj: ret) {
-        obj->holdStrongReference();
-        ctx_->removeReference(obj->gcHandle());
+    auto ret = std::move(ctx_->channel_.front());
+    for (auto& obj: ret) {
+        obj.holdStrongReference();
+        ctx_->removeReference(obj.gcHandle());
     }
 
     ctx_->channel_.pop();
@@ -31,6 +31,7 @@ public:
 
 private:
     Channel() = default;
+    using GCObject<ChannelData>::GCObject;
     void initialize(const sol::stack_object& capacity);
     friend class GC;
 };
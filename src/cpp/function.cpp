@@ -1,7 +1,91 @@
 #include "function.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
 namespace effil {
 
+namespace {
+
+std::atomic<uint64_t> lastFunctionId(0);
+std::atomic<bool> stripDebugInfo(false);
+
+// Content addressed storage of functions bytecode.
+// Buffer is removed from storage when the last function using it is destroyed.
+class BytecodeStore {
+public:
+    static BytecodeStore& instance() {
+        // Store is never destroyed: functions may outlive static objects
+        static BytecodeStore* store = new BytecodeStore();
+        return *store;
+    }
+
+    std::shared_ptr<const std::string> intern(std::string&& bytecode) {
+        const size_t hash = std::hash<std::string>()(bytecode);
+
+        // Temporary owners have to be released after unlock,
+        // because the last owner removes buffer from the store
+        std::vector<std::shared_ptr<const std::string>> candidates;
+        std::lock_guard<std::mutex> lock(lock_);
+        auto& bucket = buffers_[hash];
+        for (const auto& weakBuffer : bucket) {
+            if (auto buffer = weakBuffer.lock()) {
+                if (*buffer == bytecode)
+                    return buffer;
+                candidates.push_back(std::move(buffer));
+            }
+        }
+
+        std::shared_ptr<const std::string> buffer(new std::string(std::move(bytecode)),
+            [this, hash](const std::string* ptr) {
+                release(hash);
+                delete ptr;
+            });
+        bucket.push_back(buffer);
+        return buffer;
+    }
+
+private:
+    void release(size_t hash) {
+        std::lock_guard<std::mutex> lock(lock_);
+        auto iter = buffers_.find(hash);
+        if (iter == buffers_.end())
+            return;
+
+        auto& bucket = iter->second;
+        bucket.erase(std::remove_if(bucket.begin(), bucket.end(),
+            [](const std::weak_ptr<const std::string>& buffer) { return buffer.expired(); }),
+            bucket.end());
+        if (bucket.empty())
+            buffers_.erase(iter);
+    }
+
+    std::mutex lock_;
+    std::unordered_map<size_t, std::vector<std::weak_ptr<const std::string>>> buffers_;
+};
+
+// Registry key of the table with loaded functions.
+// Values are weak, so unused functions are released by Lua GC.
+const char* const FUNCTIONS_CACHE_KEY = "effil.functions_cache";
+
+void pushFunctionsCache(lua_State* state) {
+    lua_getfield(state, LUA_REGISTRYINDEX, FUNCTIONS_CACHE_KEY);
+    if (lua_isnil(state, -1)) {
+        lua_pop(state, 1);
+        lua_newtable(state);
+        lua_newtable(state);
+        lua_pushstring(state, "v");
+        lua_setfield(state, -2, "__mode");
+        lua_setmetatable(state, -2);
+        lua_pushvalue(state, -1);
+        lua_setfield(state, LUA_REGISTRYINDEX, FUNCTIONS_CACHE_KEY);
+    }
+}
+
+} // namespace
+
 void Function::initialize(const sol::function& luaObject) {
     SolTableToShared visited;
     initialize(luaObject, visited);
@@ -18,7 +102,8 @@ void Function::initialize(const sol::function& luaObject, SolTableToShared& visi
     lua_getinfo(state, ">u", &dbgInfo); // function is popped from stack here
     sol::stack::push(state, luaObject);
 
-    ctx_->function = dumpFunction(luaObject);
+    ctx_->id = ++lastFunctionId;
+    ctx_->function = BytecodeStore::instance().intern(dumpFunction(luaObject, stripDebugInfo));
     ctx_->upvalues.resize(dbgInfo.nups);
 #if LUA_VERSION_NUM > 501
     ctx_->envUpvaluePos = 0; // means no _G upvalue
@@ -45,16 +130,16 @@ void Function::initialize(const sol::function& luaObject, SolTableToShared& visi
         try {
             const auto& upvalue = sol::stack::pop<sol::object>(state);
             storedObject = createStoredObject(upvalue, visited);
-            assert(storedObject.get() != nullptr);
+            assert(storedObject);
         }
         catch(const std::exception& err) {
             sol::stack::pop<sol::object>(state);
             throw effil::Exception() << "bad function upvalue #" << (int)i << " (" << err.what() << ")";
         }
 
-        if (storedObject->gcHandle() != nullptr) {
-            ctx_->addReference(storedObject->gcHandle());
-            storedObject->releaseStrongReference();
+        if (storedObject.gcHandle() != nullptr) {
+            ctx_->addReference(storedObject.gcHandle());
+            storedObject.releaseStrongReference();
         }
         ctx_->upvalues[i - 1] = std::move(storedObject);
     }
@@ -63,10 +148,16 @@ void Function::initialize(const sol::function& luaObject, SolTableToShared& visi
 
 sol::object Function::convert(lua_State* state, const Converter& clbk) const
 {
-    sol::function result = loadString(state, ctx_->function);
+    sol::function result = loadString(state, *ctx_->function);
     assert(result.valid());
 
     sol::stack::push(state, result);
+    return bindUpvalues(state, clbk);
+}
+
+// Sets upvalues of function on top of the stack, pops it and returns
+sol::object Function::bindUpvalues(lua_State* state, const Converter& clbk) const
+{
     for(size_t i = 0; i < ctx_->upvalues.size(); ++i) {
 #if LUA_VERSION_NUM > 501
         if (ctx_->envUpvaluePos == i + 1) {
@@ -75,7 +166,7 @@ sol::object Function::convert(lua_State* state, const Converter& clbk) const
             continue;
         }
 #endif // LUA_VERSION_NUM > 501
-        assert(ctx_->upvalues[i].get() != nullptr);
+        assert(ctx_->upvalues[i]);
 
         sol::stack::push(state, clbk(ctx_->upvalues[i]));
         lua_setupvalue(state, -2, i + 1);
@@ -83,15 +174,84 @@ sol::object Function::convert(lua_State* state, const Converter& clbk) const
     return sol::stack::pop<sol::function>(state);
 }
 
+// Checks if environment of function on top of the stack isn't the global table anymore
+bool Function::environmentChanged(lua_State* state) const
+{
+#if LUA_VERSION_NUM > 501
+    if (ctx_->envUpvaluePos == 0)
+        return false;
+    lua_getupvalue(state, -1, ctx_->envUpvaluePos);
+    lua_pushglobaltable(state);
+#else
+    lua_getfenv(state, -1);
+    lua_pushvalue(state, LUA_GLOBALSINDEX);
+#endif // LUA_VERSION_NUM > 501
+    const bool changed = !lua_rawequal(state, -1, -2);
+    lua_pop(state, 2);
+    return changed;
+}
+
+// Pushes function loaded in this state before, loads it on first usage.
+// If a holder of the cached function has changed its environment (setfenv or _ENV upvalue),
+// the function is loaded again, so the change isn't seen by the next loads
+void Function::pushCachedFunction(lua_State* state) const
+{
+    pushFunctionsCache(state);
+    lua_pushnumber(state, static_cast<lua_Number>(ctx_->id));
+    lua_rawget(state, -2);
+    if (!lua_isnil(state, -1) && !environmentChanged(state)) {
+        lua_remove(state, -2); // pop cache
+        return;
+    }
+    lua_pop(state, 2);
+
+    sol::function loaded = loadString(state, *ctx_->function);
+    assert(loaded.valid());
+
+    pushFunctionsCache(state);
+    lua_pushnumber(state, static_cast<lua_Number>(ctx_->id));
+    sol::stack::push(state, loaded);
+    lua_rawset(state, -3);
+    lua_pop(state, 1);
+    sol::stack::push(state, loaded);
+}
+
+bool Function::luaStripDebugInfo(const sol::stack_object& strip) {
+    const bool previous = stripDebugInfo;
+    if (strip.valid()) {
+        REQUIRE(strip.get_type() == sol::type::boolean)
+                << "bad argument #1 to 'effil.strip_functions' (boolean expected, got "
+                << luaTypename(strip) << ")";
+        stripDebugInfo = strip.as<bool>();
+    }
+    return previous;
+}
+
+// Global table doesn't count: it's the same for all functions of the state
+bool Function::capturesValues() const {
+#if LUA_VERSION_NUM > 501
+    return ctx_->upvalues.size() > (ctx_->envUpvaluePos != 0 ? 1u : 0u);
+#else
+    return !ctx_->upvalues.empty();
+#endif // LUA_VERSION_NUM > 501
+}
+
 sol::object Function::loadFunction(lua_State* state) const {
-    return convert(state, [&](const StoredObject& obj){
-        return obj->unpack(sol::this_state{state});
-    });
+    const auto unpack = [&](const StoredObject& obj){
+        return obj.unpack(sol::this_state{state});
+    };
+    // Each load of function with upvalues gets its own closure, because rebinding upvalues
+    // of shared closure would reset state of closures which are already held or running.
+    // Functions without upvalues have no state, so they are loaded once per Lua state
+    if (capturesValues())
+        return convert(state, unpack);
+    pushCachedFunction(state);
+    return bindUpvalues(state, unpack);
 }
 
-sol::object Function::convertToLua(lua_State* state, BaseHolder::DumpCache& cache) const {
+sol::object Function::convertToLua(lua_State* state, StoredObject::DumpCache& cache) const {
     return convert(state, [&](const StoredObject& obj) {
-        return obj->convertToLua(sol::this_state{state}, cache);
+        return obj.convertToLua(sol::this_state{state}, cache);
     });
 }
 
@@ -9,7 +9,10 @@ namespace effil {
 
 class FunctionData : public GCData {
 public:
-    std::string function;
+    // Unique identifier of function, it's used as key in per state cache
+    uint64_t id;
+    // Bytecode buffer is shared by all functions with the same body
+    std::shared_ptr<const std::string> function;
 #if LUA_VERSION_NUM > 501
     unsigned char envUpvaluePos;
 #endif // LUA_VERSION_NUM > 501
@@ -18,14 +21,22 @@ public:
 
 class Function : public GCObject<FunctionData> {
 public:
+    // Get/set whether debug info is stripped from serialized functions
+    static bool luaStripDebugInfo(const sol::stack_object& strip);
+
     sol::object loadFunction(lua_State* state) const;
-    sol::object convertToLua(lua_State* state, BaseHolder::DumpCache& cache) const;
+    sol::object convertToLua(lua_State* state, StoredObject::DumpCache& cache) const;
 
 private:
     using Converter = std::function<sol::object(const StoredObject&)>;
     sol::object convert(lua_State* state, const Converter& clbk) const;
+    sol::object bindUpvalues(lua_State* state, const Converter& clbk) const;
+    void pushCachedFunction(lua_State* state) const;
+    bool environmentChanged(lua_State* state) const;
+    bool capturesValues() const;
 
     Function() = default;
+    using GCObject<FunctionData>::GCObject;
     void initialize(const sol::function& luaObject, SolTableToShared& visited);
     void initialize(const sol::function& luaObject);
     friend class GC;
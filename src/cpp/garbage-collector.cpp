@@ -3,21 +3,65 @@
 #include "utils.h"
 #include "lua-helpers.h"
 
+#include "shared-table.h"
+#include "channel.h"
+#include "function.h"
+#include "thread.h"
+#include "thread-runner.h"
+#include "thread-pool.h"
+#include "array.h"
+#include "buffer.h"
+#include "string-pool.h"
+
 #include <cassert>
+#include <limits>
 
 namespace effil {
 
 constexpr size_t MINIMUN_SIZE_LEFT = 100;
 
+// Upper bounds of pause histogram buckets in milliseconds
+constexpr std::array<double, 5> PAUSE_BUCKETS = {{ 0.01, 0.1, 1., 10., 100. }};
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+thread_local bool insideGC = false;
+
+// Objects released by deletion of garbage are reclaimed by the same GC operation,
+// so nested reclaim calls have to be postponed instead of locking GC again
+class GCLock {
+public:
+    explicit GCLock(std::mutex& lock) : lock_(lock) {
+        insideGC = true;
+    }
+    ~GCLock() {
+        insideGC = false;
+    }
+
+private:
+    std::lock_guard<std::mutex> lock_;
+};
+
+} // namespace
+
 GC::GC()
         : enabled_(true)
         , lastCleanup_(MINIMUN_SIZE_LEFT)
-        , step_(2.) {}
+        , step_(2.)
+        , budget_(0)
+        , phase_(Phase::Idle)
+        , cursor_(0)
+        , marking_(false)
+        , triggered_(0) {}
 
 // Here is the naive tri-color marking
 // garbage collecting algorithm implementation.
 void GC::collect() {
-    std::lock_guard<std::mutex> g(lock_);
+    GCLock g(lock_);
+    const auto start = Clock::now();
+    abortCycle();
 
     std::unordered_set<GCHandle> grey;
     std::unordered_map<GCHandle, std::unique_ptr<BaseGCObject>> black;
@@ -42,9 +86,272 @@ void GC::collect() {
     // Sweep phase
     DEBUG("gc") << "Removing " << (objects_.size() - black.size())
                 << " out of " << objects_.size() << std::endl;
+    for (const auto& handleAndObject : objects_) {
+        if (handleAndObject.second) {
+            dropReferences(handleAndObject.first, [&](GCHandle ref) { return black.count(ref) != 0; });
+            countDeleted(*handleAndObject.second);
+        }
+    }
     objects_ = std::move(black);
 
     lastCleanup_.store(std::max(objects_.size(), MINIMUN_SIZE_LEFT));
+    reclaimPending();
+
+    ++stats_.collections;
+    countPause(Clock::now() - start);
+}
+
+void GC::reclaim(GCHandle handle) {
+    if (!enabled_)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(pendingLock_);
+        pending_.push_back(handle);
+    }
+    if (insideGC)
+        return;
+
+    GCLock g(lock_);
+    reclaimPending();
+}
+
+// Deletion of object may release the last references to other objects,
+// so candidates are processed until there is nothing left
+void GC::reclaimPending() {
+    // Fast path is suspended until incremental cycle is finished,
+    // otherwise swept handles may be reused by new objects
+    if (phase_ != Phase::Idle)
+        return;
+
+    std::vector<GCHandle> candidates;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(pendingLock_);
+            candidates.swap(pending_);
+        }
+        if (candidates.empty())
+            return;
+
+        for (GCHandle handle : candidates) {
+            auto it = objects_.find(handle);
+            // candidate may be already deleted or handle may be reused by new object,
+            // anyway the state of object is checked under the lock
+            if (it == objects_.end() || !static_cast<GCData*>(handle)->unused())
+                continue;
+
+            for (GCHandle ref : static_cast<GCData*>(handle)->takeReferences()) {
+                if (static_cast<GCData*>(ref)->releaseReferrer()) {
+                    std::lock_guard<std::mutex> lock(pendingLock_);
+                    pending_.push_back(ref);
+                }
+            }
+            countDeleted(*it->second);
+            ++stats_.reclaimedByRefcount;
+            objects_.erase(it);
+        }
+        candidates.clear();
+    }
+}
+
+// Decrements referrers counter of objects referred by garbage.
+// Referred objects which are garbage too may be already deleted and they are skipped
+void GC::dropReferences(GCHandle handle, const std::function<bool(GCHandle)>& alive) {
+    for (GCHandle ref : static_cast<GCData*>(handle)->takeReferences())
+        if (alive(ref))
+            static_cast<GCData*>(ref)->releaseReferrer();
+}
+
+// Incremental mode splits collection into small steps performed on objects creation.
+// Cycle starts with snapshot of existing objects and consists of two phases:
+//   1. Mark: objects from snapshot which have views are scanned as roots,
+//      then references of grey objects are traversed.
+//   2. Sweep: unmarked objects from snapshot are removed.
+// Each step handles at most budget_ objects, that bounds a pause of single step.
+// While marking is in progress objects are shaded when they get a new reference
+// (GCData::addReference) or a new view (GC::get) and new objects are marked immediately,
+// so object which became reachable after its scanning can't be lost.
+void GC::incrementalStep() {
+    GCLock g(lock_);
+    if (phase_ == Phase::Idle) {
+        if (objects_.size() < step_ * lastCleanup_)
+            return;
+        ++triggered_;
+        startCycle();
+    }
+
+    const auto start = Clock::now();
+
+    if (phase_ == Phase::Mark && markStep(budget_)) {
+        phase_ = Phase::Sweep;
+        cursor_ = 0;
+    }
+    else if (phase_ == Phase::Sweep && sweepStep(budget_)) {
+        DEBUG("gc") << "Incremental cycle is finished, " << objects_.size() << " objects left" << std::endl;
+        abortCycle();
+        lastCleanup_.store(std::max(objects_.size(), MINIMUN_SIZE_LEFT));
+        reclaimPending();
+        ++stats_.collections;
+    }
+
+    ++stats_.steps;
+    countPause(Clock::now() - start);
+}
+
+void GC::startCycle() {
+    snapshot_.clear();
+    snapshot_.reserve(objects_.size());
+    for (const auto& handleAndObject : objects_)
+        snapshot_.push_back(handleAndObject.first);
+
+    cursor_ = 0;
+    marked_.clear();
+    grey_.clear();
+    phase_ = Phase::Mark;
+
+    std::lock_guard<std::mutex> lock(barrierLock_);
+    barrierGrey_.clear();
+    marking_ = true;
+}
+
+void GC::abortCycle() {
+    {
+        std::lock_guard<std::mutex> lock(barrierLock_);
+        marking_ = false;
+        barrierGrey_.clear();
+    }
+    phase_ = Phase::Idle;
+    cursor_ = 0;
+    std::vector<GCHandle>().swap(snapshot_);
+    std::unordered_set<GCHandle>().swap(marked_);
+    grey_.clear();
+}
+
+// Returns true if marking is finished
+bool GC::markStep(size_t budget) {
+    {
+        std::lock_guard<std::mutex> lock(barrierLock_);
+        for (GCHandle handle : barrierGrey_)
+            if (marked_.insert(handle).second)
+                grey_.push_back(handle);
+        barrierGrey_.clear();
+    }
+
+    for (; budget > 0 && cursor_ < snapshot_.size(); --budget) {
+        const GCHandle handle = snapshot_[cursor_++];
+        if (objects_.at(handle)->instances() > 1 && marked_.insert(handle).second)
+            grey_.push_back(handle);
+    }
+
+    for (; budget > 0 && !grey_.empty(); --budget) {
+        const GCHandle handle = grey_.back();
+        grey_.pop_back();
+        for (GCHandle refHandle : objects_.at(handle)->refers()) {
+            assert(objects_.count(refHandle));
+            if (marked_.insert(refHandle).second)
+                grey_.push_back(refHandle);
+        }
+    }
+
+    if (cursor_ < snapshot_.size() || !grey_.empty())
+        return false;
+
+    // Barrier has to be disabled atomically with the last check:
+    // object shaded after that is reachable from already marked ones
+    std::lock_guard<std::mutex> lock(barrierLock_);
+    if (!barrierGrey_.empty())
+        return false;
+    marking_ = false;
+    return true;
+}
+
+// Returns true if sweeping is finished
+bool GC::sweepStep(size_t budget) {
+    for (; budget > 0 && cursor_ < snapshot_.size(); --budget) {
+        const GCHandle handle = snapshot_[cursor_++];
+        if (marked_.count(handle) == 0) {
+            auto it = objects_.find(handle);
+            dropReferences(handle, [this](GCHandle ref) { return marked_.count(ref) != 0; });
+            countDeleted(*it->second);
+            objects_.erase(it);
+        }
+    }
+    return cursor_ == snapshot_.size();
+}
+
+void GC::shadeSlow(GCHandle handle) {
+    std::lock_guard<std::mutex> lock(barrierLock_);
+    if (marking_)
+        barrierGrey_.push_back(handle);
+}
+
+size_t GC::budget() {
+    std::lock_guard<std::mutex> g(lock_);
+    return budget_;
+}
+
+void GC::budget(size_t newBudget) {
+    GCLock g(lock_);
+    budget_ = newBudget;
+    if (budget_ == 0) {
+        abortCycle();
+        reclaimPending();
+    }
+}
+
+void GC::countDeleted(const BaseGCObject& object) {
+    ++stats_.reclaimed[std::type_index(typeid(object))];
+}
+
+void GC::countPause(std::chrono::nanoseconds pause) {
+    static_assert(PAUSE_BUCKETS.size() + 1 == HISTOGRAM_SIZE, "Wrong number of pause buckets");
+    stats_.totalPause += pause;
+    stats_.maxPause = std::max(stats_.maxPause, pause);
+
+    const double ms = std::chrono::duration<double, std::milli>(pause).count();
+    size_t bucket = 0;
+    while (bucket < PAUSE_BUCKETS.size() && ms > PAUSE_BUCKETS[bucket])
+        ++bucket;
+    ++stats_.histogram[bucket];
+}
+
+sol::table GC::luaStats(sol::state_view& lua) {
+    static const std::vector<std::pair<std::type_index, const char*>> typeNames = {
+        { typeid(SharedTable), "table" },
+        { typeid(Channel), "channel" },
+        { typeid(Function), "function" },
+        { typeid(Thread), "thread" },
+        { typeid(ThreadRunner), "thread_runner" },
+        { typeid(ThreadPool), "pool" },
+        { typeid(Array), "array" },
+        { typeid(Buffer), "buffer" }
+    };
+
+    std::lock_guard<std::mutex> g(lock_);
+
+    sol::table reclaimed = lua.create_table();
+    for (const auto& typeAndName : typeNames) {
+        const auto it = stats_.reclaimed.find(typeAndName.first);
+        reclaimed[typeAndName.second] = it == stats_.reclaimed.end() ? 0 : it->second;
+    }
+
+    sol::table histogram = lua.create_table();
+    for (size_t i = 0; i < HISTOGRAM_SIZE; ++i) {
+        const double bound = i < PAUSE_BUCKETS.size() ? PAUSE_BUCKETS[i] : std::numeric_limits<double>::infinity();
+        histogram[i + 1] = lua.create_table_with("le", bound, "count", stats_.histogram[i]);
+    }
+
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    return lua.create_table_with(
+        "collections", stats_.collections,
+        "steps", stats_.steps,
+        "triggered", triggered_.load(),
+        "total_pause", std::chrono::duration_cast<Milliseconds>(stats_.totalPause).count(),
+        "max_pause", std::chrono::duration_cast<Milliseconds>(stats_.maxPause).count(),
+        "histogram", histogram,
+        "reclaimed", reclaimed,
+        "reclaimed_by_refcount", stats_.reclaimedByRefcount,
+        "interned_strings", StringPool::instance().size()
+    );
 }
 
 size_t GC::count() const {
@@ -79,6 +386,23 @@ sol::table GC::exportAPI(sol::state_view& lua) {
     api["count"] = [] {
         return instance().count();
     };
+    api["stats"] = [](sol::this_state state) {
+        sol::state_view lua(state);
+        return instance().luaStats(lua);
+    };
+    api["incremental"] = [](const sol::stack_object& newBudget){
+        auto previous = instance().budget();
+        if (newBudget.valid()) {
+            REQUIRE(newBudget.get_type() == sol::type::number)
+                    << "bad argument #1 to 'effil.gc.incremental' (number expected, got "
+                    << luaTypename(newBudget) << ")";
+            REQUIRE(newBudget.as<int>() >= 0)
+                    << "effil.gc.incremental: invalid budget value = "
+                    << newBudget.as<int>();
+            instance().budget(newBudget.as<size_t>());
+        }
+        return previous;
+    };
     return api;
 }
 
@@ -1,10 +1,17 @@
 #pragma once
 
 #include "gc-object.h"
+#include "gc-data.h"
 #include <sol.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <typeindex>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace effil {
 
@@ -17,13 +24,22 @@ public:
     // This method is used to create all managed objects.
     template <typename ViewType, typename... Args>
     ViewType create(Args&&... args) {
-        if (enabled_ && count() >= step_ * lastCleanup_)
-            collect();
+        if (enabled_) {
+            if (budget_ > 0) {
+                incrementalStep();
+            } else if (count() >= step_ * lastCleanup_) {
+                ++triggered_;
+                collect();
+            }
+        }
 
         std::unique_lock<std::mutex> g(lock_);
         std::unique_ptr<ViewType> object(new ViewType);
         auto copy = *object;
         objects_.emplace(object->handle(), std::move(object));
+        // objects created during marking are considered as reachable
+        if (phase_ == Phase::Mark)
+            marked_.insert(copy.handle());
         g.unlock();
 
         // We separate initialization out of construction cause the object under construction
@@ -32,31 +48,94 @@ public:
         return copy;
     }
 
+    // Lock free lookup of object by handle.
+    // Handle is an address of object data and the object is alive
+    // while someone holds reference to it, so new view is made directly from the data.
     template <typename ObjectType>
     ObjectType get(GCHandle handle) {
-        std::lock_guard<std::mutex> g(lock_);
+        using Impl = typename ObjectType::ImplType;
+        Impl* data = static_cast<Impl*>(handle);
+        assert(data != nullptr);
+        assert(dynamic_cast<Impl*>(static_cast<GCData*>(data)) == data);
 
-        auto it = objects_.find(handle);
-        assert(it != objects_.end());
+        shade(handle);
+        return ObjectType(std::static_pointer_cast<Impl>(data->shared_from_this()));
+    }
 
-        auto result = dynamic_cast<ObjectType*>(it->second.get());
-        assert(result);
-        return *result;
+    // Barrier of incremental marking.
+    // Has to be called when object becomes referenced by another object or by new view,
+    // otherwise it may be missed by marking which is already in progress.
+    void shade(GCHandle handle) {
+        if (marking_.load(std::memory_order_acquire))
+            shadeSlow(handle);
     }
 
+    // Deletes object immediately if it is not used anymore (see GCData::unused).
+    // Cyclic garbage is left for tracing collection.
+    void reclaim(GCHandle handle);
+
 private:
+    enum class Phase {
+        Idle,
+        Mark,
+        Sweep
+    };
+
     mutable std::mutex lock_;
     bool enabled_;
     std::atomic<uint64_t> lastCleanup_;
     double step_;
     std::unordered_map<GCHandle, std::unique_ptr<BaseGCObject>> objects_;
 
+    // Incremental mode state, guarded by lock_.
+    // Zero budget means stop-the-world collection.
+    size_t budget_;
+    Phase phase_;
+    std::vector<GCHandle> snapshot_;
+    size_t cursor_;
+    std::unordered_set<GCHandle> marked_;
+    std::vector<GCHandle> grey_;
+
+    std::atomic<bool> marking_;
+    std::mutex barrierLock_;
+    std::vector<GCHandle> barrierGrey_;
+
+    // Candidates for deletion by reference counting
+    std::mutex pendingLock_;
+    std::vector<GCHandle> pending_;
+
+    // Telemetry, guarded by lock_ (except triggered_)
+    static constexpr size_t HISTOGRAM_SIZE = 6;
+    struct Stats {
+        size_t collections = 0;
+        size_t steps = 0;
+        std::chrono::nanoseconds totalPause{0};
+        std::chrono::nanoseconds maxPause{0};
+        std::array<size_t, HISTOGRAM_SIZE> histogram{};
+        std::unordered_map<std::type_index, size_t> reclaimed;
+        size_t reclaimedByRefcount = 0;
+    } stats_;
+    std::atomic<size_t> triggered_;
+
 private:
     GC();
     GC(GC&&) = delete;
     GC(const GC&) = delete;
 
     void collect();
+    void incrementalStep();
+    void startCycle();
+    void abortCycle();
+    bool markStep(size_t budget);
+    bool sweepStep(size_t budget);
+    void shadeSlow(GCHandle handle);
+    void reclaimPending();
+    void countDeleted(const BaseGCObject& object);
+    void countPause(std::chrono::nanoseconds pause);
+    sol::table luaStats(sol::state_view& lua);
+    void dropReferences(GCHandle handle, const std::function<bool(GCHandle)>& alive);
+    size_t budget();
+    void budget(size_t newBudget);
     void pause() { enabled_ = false; }
     void resume() { enabled_ = true; }
     double step() const { return step_; }
@@ -1,12 +1,14 @@
 #include "gc-data.h"
 
+#include "garbage-collector.h"
+
 #include <mutex>
 #include <cassert>
 
 namespace effil {
 
 std::unordered_set<GCHandle> GCData::refers() const {
-    std::lock_guard<SpinMutex> lock(mutex_);
+    std::lock_guard<SharedMutex> lock(mutex_);
     return std::unordered_set<GCHandle>(
             weakRefs_.begin(),
             weakRefs_.end());
@@ -15,17 +17,37 @@ std::unordered_set<GCHandle> GCData::refers() const {
 void GCData::addReference(GCHandle handle) {
     if (handle == GCNull) return;
 
-    std::lock_guard<SpinMutex> lock(mutex_);
-    weakRefs_.insert(handle);
+    {
+        std::lock_guard<SharedMutex> lock(mutex_);
+        weakRefs_.insert(handle);
+    }
+    static_cast<GCData*>(handle)->referrers_.fetch_add(1);
+    // write barrier for incremental GC
+    GC::instance().shade(handle);
 }
 
 void GCData::removeReference(GCHandle handle) {
     if (handle == GCNull) return;
 
-    std::lock_guard<SpinMutex> lock(mutex_);
-    auto hit = weakRefs_.find(handle);
-    assert(hit != std::end(weakRefs_));
-    weakRefs_.erase(hit);
+    {
+        std::lock_guard<SharedMutex> lock(mutex_);
+        auto hit = weakRefs_.find(handle);
+        assert(hit != std::end(weakRefs_));
+        weakRefs_.erase(hit);
+    }
+    if (static_cast<GCData*>(handle)->releaseReferrer())
+        GC::instance().reclaim(handle);
+}
+
+void GCData::releaseView() {
+    // the last view besides the one owned by GC
+    if (views_.fetch_sub(1) == 2 && referrers_.load() == 0)
+        GC::instance().reclaim(this);
+}
+
+std::unordered_multiset<GCHandle> GCData::takeReferences() {
+    std::lock_guard<SharedMutex> lock(mutex_);
+    return std::move(weakRefs_);
 }
 
 } // namespace effil
\ No newline at end of file
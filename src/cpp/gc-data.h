@@ -1,17 +1,19 @@
 #pragma once
 
-#include "spin-mutex.h"
+#include "shared-mutex.h"
 #include "gc-object.h"
 
+#include <atomic>
+#include <memory>
 #include <unordered_set>
 
 namespace effil {
 
 // Base class for data represented in Lua.
 // Derived classes always managed by corresponding views.
-class GCData {
+class GCData : public std::enable_shared_from_this<GCData> {
 public:
-    GCData() = default;
+    GCData() : views_(0), referrers_(0) {}
     virtual ~GCData() = default;
 
     // List of weak references to nested objects
@@ -19,13 +21,26 @@ public:
     void addReference(GCHandle handle);
     void removeReference(GCHandle handle);
 
+    // Reference counting of views and referring objects.
+    // Object is not used anymore when GC holds the only view of it
+    // and nobody refers to it, so it may be reclaimed without tracing.
+    void acquireView() { views_.fetch_add(1); }
+    void releaseView();
+    bool releaseReferrer() { return referrers_.fetch_sub(1) == 1 && views_.load() == 1; }
+    bool unused() const { return views_.load() == 1 && referrers_.load() == 0; }
+
+    // Used by GC on object deletion
+    std::unordered_multiset<GCHandle> takeReferences();
+
 public:
     GCData(const GCData&) = delete;
     GCData& operator=(const GCData&) = delete;
 
 private:
-    mutable SpinMutex mutex_;
+    mutable SharedMutex mutex_;
     std::unordered_multiset<GCHandle> weakRefs_;
+    std::atomic<size_t> views_;
+    std::atomic<size_t> referrers_;
 };
 
 } // namespace effil
\ No newline at end of file
@@ -24,12 +24,29 @@ public:
 template<typename Impl>
 class GCObject : public BaseGCObject {
 public:
-    GCObject() : ctx_(std::make_shared<Impl>())
-    {}
+    using ImplType = Impl;
+
+    GCObject() : ctx_(std::make_shared<Impl>()) {
+        ctx_->acquireView();
+    }
 
     // All views are copy constructable
-    GCObject(const GCObject&) = default;
-    GCObject& operator=(const GCObject&) = default;
+    GCObject(const GCObject& other) : ctx_(other.ctx_) {
+        ctx_->acquireView();
+    }
+
+    GCObject& operator=(const GCObject& other) {
+        if (ctx_ != other.ctx_) {
+            other.ctx_->acquireView();
+            ctx_->releaseView();
+            ctx_ = other.ctx_;
+        }
+        return *this;
+    }
+
+    ~GCObject() {
+        ctx_->releaseView();
+    }
 
     // Unique handle for any copy of GCData in any lua state
     GCHandle handle() const final {
@@ -48,6 +65,11 @@ public:
     }
 
 protected:
+    // New view of existing object
+    explicit GCObject(std::shared_ptr<Impl> ctx) : ctx_(std::move(ctx)) {
+        ctx_->acquireView();
+    }
+
     std::shared_ptr<Impl> ctx_;
 };
 
@@ -28,13 +28,14 @@ int dumpMemoryWriter(lua_State*, const void* batch, size_t batchSize, void* stor
 
 } // namespace
 
-std::string dumpFunction(const sol::function& f) {
+std::string dumpFunction(const sol::function& f, bool strip) {
     sol::state_view lua(f.lua_state());
     sol::stack::push(lua, f);
     std::string result;
 #if LUA_VERSION_NUM == 503
-    int ret = lua_dump(lua, dumpMemoryWriter, &result, 0 /* not strip debug info*/);
+    int ret = lua_dump(lua, dumpMemoryWriter, &result, strip ? 1 : 0);
 #else
+    (void)strip; // get rid of 'unused' warning
     int ret = lua_dump(lua, dumpMemoryWriter, &result);
 #endif
     REQUIRE(ret == LUA_OK) << "Unable to dump Lua function: " << luaError(ret);
@@ -9,8 +9,12 @@ namespace effil {
 class SharedTable;
 class Channel;
 class Thread;
+class ThreadPool;
+class Array;
+class Buffer;
 
-std::string dumpFunction(const sol::function& f);
+// Debug info can be stripped only in Lua 5.3
+std::string dumpFunction(const sol::function& f, bool strip = false);
 sol::function loadString(const sol::state_view& lua, const std::string& str,
                          const sol::optional<std::string>& source = sol::nullopt);
 std::chrono::milliseconds fromLuaTime(int duration, const sol::optional<std::string>& period);
@@ -24,6 +28,12 @@ std::string luaTypename(const SolObject& obj) {
             return "effil.channel";
         else if (obj.template is<Thread>())
             return "effil.thread";
+        else if (obj.template is<ThreadPool>())
+            return "effil.pool";
+        else if (obj.template is<Array>())
+            return "effil.array";
+        else if (obj.template is<Buffer>())
+            return "effil.buffer";
         else
             return "userdata";
     }
@@ -54,7 +64,7 @@ namespace stack {
         int push(lua_State* state, const effil::StoredArray& args) {
             int p = 0;
             for (const auto& i : args) {
-                p += stack::push(state, i->unpack(sol::this_state{state}));
+                p += stack::push(state, i.unpack(sol::this_state{state}));
             }
             return p;
         }
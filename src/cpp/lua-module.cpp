@@ -1,30 +1,69 @@
 #include "thread.h"
 #include "this-thread.h"
 #include "thread-runner.h"
+#include "thread-pool.h"
 #include "shared-table.h"
 #include "garbage-collector.h"
+#include "state-cache.h"
 #include "channel.h"
+#include "function.h"
+#include "array.h"
+#include "buffer.h"
 
 #include <lua.hpp>
 
+#include <algorithm>
+#include <limits>
+
 using namespace effil;
 
 namespace {
 
-sol::object createTable(sol::this_state lua, const sol::optional<sol::object>& tbl) {
+constexpr size_t MAX_TABLE_SHARDS = 1024;
+
+sol::object createTable(sol::this_state lua, const sol::optional<sol::object>& tbl, const sol::stack_object& options) {
+    size_t shards = 1;
+    if (options.valid()) {
+        REQUIRE(options.get_type() == sol::type::table)
+                << "bad argument #2 to 'effil.table' (table expected, got "
+                << luaTypename(options) << ")";
+        const sol::object shardsOption = options.as<sol::table>()["shards"];
+        if (shardsOption.valid()) {
+            REQUIRE(shardsOption.get_type() == sol::type::number)
+                    << "effil.table: shards must be a number";
+            const double requested = shardsOption.as<double>();
+            REQUIRE(requested >= 1 && requested <= MAX_TABLE_SHARDS && requested == static_cast<size_t>(requested))
+                    << "effil.table: invalid number of shards = " << requested;
+            shards = static_cast<size_t>(requested);
+        }
+    }
+
     if (tbl)
     {
         REQUIRE(tbl->get_type() == sol::type::table) << "Unexpected type for effil.table, table expected got: "
                                                      << lua_typename(lua, (int)tbl->get_type());
-        return createStoredObject(*tbl)->unpack(lua);
+        if (shards == 1)
+            return createStoredObject(*tbl).unpack(lua);
+
+        SharedTable table = GC::instance().create<SharedTable>(shards);
+        dumpLuaTable(table, tbl->as<sol::table>());
+        return sol::make_object(lua, table);
     }
-    return sol::make_object(lua, GC::instance().create<SharedTable>());
+    return sol::make_object(lua, GC::instance().create<SharedTable>(shards));
 }
 
 sol::object createChannel(const sol::stack_object& capacity, sol::this_state lua) {
     return sol::make_object(lua, GC::instance().create<Channel>(capacity));
 }
 
+sol::object createArray(const sol::stack_object& type, const sol::stack_object& size, sol::this_state lua) {
+    return sol::make_object(lua, GC::instance().create<Array>(type, size));
+}
+
+sol::object createBuffer(const sol::stack_object& init, sol::this_state lua) {
+    return sol::make_object(lua, GC::instance().create<Buffer>(init));
+}
+
 SharedTable globalTable = GC::instance().create<SharedTable>();
 
 std::string getLuaTypename(const sol::stack_object& obj) {
@@ -36,15 +75,22 @@ size_t luaSize(const sol::stack_object& obj) {
         return SharedTable::luaSize(obj);
     else if (obj.is<Channel>())
         return obj.as<Channel>().size();
+    else if (obj.is<Array>())
+        return obj.as<Array>().size();
+    else if (obj.is<Buffer>())
+        return obj.as<Buffer>().size();
 
     throw effil::Exception() << "Unsupported type "
                              << luaTypename(obj) << " for effil.size()";
 }
 
-sol::object luaDump(sol::this_state lua, const sol::stack_object& obj) {
+sol::object luaDump(sol::this_state lua, const sol::stack_object& obj, const sol::stack_object& previous) {
     if (obj.is<SharedTable>()) {
-        BaseHolder::DumpCache cache;
-        return obj.as<SharedTable>().luaDump(lua, cache);
+        REQUIRE(!previous.valid() || previous.get_type() == sol::type::table ||
+                (previous.get_type() == sol::type::boolean && previous.as<bool>()))
+                << "bad argument #2 to 'effil.dump' (table or true expected, got "
+                << luaTypename(previous) << ")";
+        return obj.as<SharedTable>().luaDump(lua, previous);
     }
     else if (obj.get_type() == sol::type::table) {
         return obj;
@@ -68,6 +114,44 @@ sol::table createThreadRunner(sol::this_state state, const sol::stack_object& ob
     ));
 }
 
+sol::object createThreadPool(sol::this_state state, const sol::stack_object& workers, const sol::stack_object& options) {
+    size_t workersNumber = std::max(std::thread::hardware_concurrency(), 1u);
+    if (workers.valid()) {
+        REQUIRE(workers.get_type() == sol::type::number)
+                << "bad argument #1 to 'effil.pool' (number expected, got "
+                << luaTypename(workers) << ")";
+        REQUIRE(workers.as<int>() > 0)
+                << "effil.pool: invalid number of workers = " << workers.as<int>();
+        workersNumber = workers.as<size_t>();
+    }
+
+    // the same default as thread runner has
+    int step = 200;
+    if (options.valid()) {
+        REQUIRE(options.get_type() == sol::type::table)
+                << "bad argument #2 to 'effil.pool' (table expected, got "
+                << luaTypename(options) << ")";
+        const sol::object stepOption = options.as<sol::table>()["step"];
+        if (stepOption.valid()) {
+            REQUIRE(stepOption.get_type() == sol::type::number)
+                    << "effil.pool: step must be a number";
+            const double requested = stepOption.as<double>();
+            REQUIRE(requested >= 0 && requested <= std::numeric_limits<int>::max() &&
+                    requested == static_cast<int>(requested))
+                    << "effil.pool: invalid step = " << requested;
+            step = static_cast<int>(requested);
+        }
+    }
+
+    auto lua = sol::state_view(state);
+    return sol::make_object(lua, GC::instance().create<ThreadPool>(
+        lua["package"]["path"],
+        lua["package"]["cpath"],
+        step,
+        workersNumber
+    ));
+}
+
 } // namespace
 
 extern "C"
@@ -80,17 +164,26 @@ int luaopen_effil(lua_State* L) {
     SharedTable::exportAPI(lua);
     Channel::exportAPI(lua);
     ThreadRunner::exportAPI(lua);
+    ThreadPool::exportAPI(lua);
+    Array::exportAPI(lua);
+    Buffer::exportAPI(lua);
 
     const sol::table  gcApi     = GC::exportAPI(lua);
+    const sol::table  cacheApi  = LuaStateCache::exportAPI(lua);
+    const sol::table  atomicApi = SharedTable::exportAtomicAPI(lua);
     const sol::object gLuaTable = sol::make_object(lua, globalTable);
 
-    const auto luaIndex = [gcApi, gLuaTable](
+    const auto luaIndex = [gcApi, cacheApi, atomicApi, gLuaTable](
             const sol::stack_object& obj, const std::string& key) -> sol::object
     {
         if (key == "G")
             return gLuaTable;
         else if (key == "gc")
             return gcApi;
+        else if (key == "state_cache")
+            return cacheApi;
+        else if (key == "atomic")
+            return atomicApi;
         else if (key == "version")
             return sol::make_object(obj.lua_state(), "0.1.0");
         return sol::nil;
@@ -98,22 +191,32 @@ int luaopen_effil(lua_State* L) {
 
     sol::usertype<EffilApiMarker> type("new", sol::no_constructor,
         "thread",       createThreadRunner,
+        "pool",         createThreadPool,
+        "wait_any",     Thread::luaWaitAny,
+        "wait_all",     Thread::luaWaitAll,
         "thread_id",    this_thread::threadId,
         "sleep",        this_thread::sleep,
+        "clock",        this_thread::clock,
         "yield",        this_thread::yield,
         "pcall",        this_thread::pcall,
         "table",        createTable,
         "rawset",       SharedTable::luaRawSet,
         "rawget",       SharedTable::luaRawGet,
+        "get_many",     SharedTable::luaGetMany,
+        "set_many",     SharedTable::luaSetMany,
+        "freeze",       SharedTable::luaFreeze,
         "setmetatable", SharedTable::luaSetMetatable,
         "getmetatable", SharedTable::luaGetMetatable,
         "channel",      createChannel,
+        "array",        createArray,
+        "buffer",       createBuffer,
         "type",         getLuaTypename,
         "pairs",        SharedTable::globalLuaPairs,
         "ipairs",       SharedTable::globalLuaIPairs,
         "next",         SharedTable::globalLuaNext,
         "size",         luaSize,
         "dump",         luaDump,
+        "strip_functions", Function::luaStripDebugInfo,
         "hardware_threads", std::thread::hardware_concurrency,
         sol::meta_function::index, luaIndex
     );
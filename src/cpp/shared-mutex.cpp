@@ -0,0 +1,162 @@
+#include "shared-mutex.h"
+
+#include <climits>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+namespace effil {
+
+namespace {
+
+// Lock holders are expected to leave in a few microseconds,
+// so waiter spins up to 2 * MAX_SPIN pauses before parking
+constexpr uint32_t MAX_SPIN = 64;
+
+inline void cpuRelax() noexcept {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    _mm_pause();
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_ia32_pause();
+#elif defined(__GNUC__) && defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Exponential backoff: calls tryLock with growing pauses between attempts.
+// Returns false if the lock is still busy and the thread has to park
+template <typename Func>
+bool spin(const Func& tryLock) noexcept {
+    for (uint32_t pauses = 1; pauses <= MAX_SPIN; pauses *= 2) {
+        if (tryLock())
+            return true;
+        for (uint32_t i = 0; i < pauses; ++i)
+            cpuRelax();
+    }
+    return false;
+}
+
+#ifdef __linux__
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex requires plain 32-bit word");
+
+void futexWait(std::atomic<uint32_t>& word, uint32_t expected) noexcept {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t>& word, int count) noexcept {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+#endif // __linux__
+
+} // namespace
+
+constexpr SharedMutex::State SharedMutex::READER;
+constexpr SharedMutex::State SharedMutex::READERS_MASK;
+constexpr SharedMutex::State SharedMutex::WAITING_WRITER;
+constexpr SharedMutex::State SharedMutex::WAITING_WRITERS_MASK;
+constexpr SharedMutex::State SharedMutex::READERS_PARKED;
+constexpr SharedMutex::State SharedMutex::WRITER;
+
+// Sleepers counter and epoch are sequentially consistent:
+// either notifier sees the sleeper or the sleeper sees the new epoch
+void ParkingEvent::wait(uint32_t epoch) noexcept {
+#ifdef __linux__
+    sleepers_.fetch_add(1);
+    if (epoch_.load() == epoch)
+        futexWait(epoch_, epoch);
+    sleepers_.fetch_sub(1);
+#else
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleepers_.fetch_add(1);
+    while (epoch_.load() == epoch)
+        cv_.wait(lock);
+    sleepers_.fetch_sub(1);
+#endif
+}
+
+void ParkingEvent::notify(bool all) noexcept {
+    epoch_.fetch_add(1);
+    if (sleepers_.load() == 0)
+        return;
+#ifdef __linux__
+    futexWake(epoch_, all ? INT_MAX : 1);
+#else
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    if (all)
+        cv_.notify_all();
+    else
+        cv_.notify_one();
+#endif
+}
+
+void SharedMutex::lockSlow() noexcept {
+    const auto tryLock = [this]() {
+        State state = state_.load(std::memory_order_relaxed);
+        return (state & (WRITER | READERS_MASK)) == 0 &&
+               state_.compare_exchange_weak(state, state | WRITER, std::memory_order_acquire,
+                                            std::memory_order_relaxed);
+    };
+    if (spin(tryLock))
+        return;
+
+    // registered writer blocks new readers
+    state_.fetch_add(WAITING_WRITER, std::memory_order_relaxed);
+    while (true) {
+        const uint32_t epoch = writers_.epoch();
+        State state = state_.load(std::memory_order_relaxed);
+        while ((state & (WRITER | READERS_MASK)) == 0) {
+            if (state_.compare_exchange_weak(state, state - WAITING_WRITER + WRITER,
+                                             std::memory_order_acquire, std::memory_order_relaxed))
+                return;
+        }
+        writers_.wait(epoch);
+    }
+}
+
+void SharedMutex::lockSharedSlow() noexcept {
+    const auto tryLock = [this]() {
+        State state = state_.load(std::memory_order_relaxed);
+        return (state & (WRITER | WAITING_WRITERS_MASK)) == 0 &&
+               state_.compare_exchange_weak(state, state + READER, std::memory_order_acquire,
+                                            std::memory_order_relaxed);
+    };
+    if (spin(tryLock))
+        return;
+
+    while (true) {
+        const uint32_t epoch = readers_.epoch();
+        State state = state_.load(std::memory_order_relaxed);
+        if ((state & (WRITER | WAITING_WRITERS_MASK)) == 0) {
+            if (state_.compare_exchange_weak(state, state + READER, std::memory_order_acquire,
+                                             std::memory_order_relaxed))
+                return;
+            continue;
+        }
+        // the flag tells writer to wake readers up on unlock
+        if ((state & READERS_PARKED) == 0 &&
+                !state_.compare_exchange_weak(state, state | READERS_PARKED, std::memory_order_relaxed))
+            continue;
+        readers_.wait(epoch);
+    }
+}
+
+// Waiting writers go first, readers are woken up by the last of them
+void SharedMutex::wakeAfterWriter(State state) noexcept {
+    if ((state & WAITING_WRITERS_MASK) != 0) {
+        writers_.notifyOne();
+    } else if ((state & READERS_PARKED) != 0) {
+        state_.fetch_and(~READERS_PARKED, std::memory_order_relaxed);
+        readers_.notifyAll();
+    }
+}
+
+} // effil
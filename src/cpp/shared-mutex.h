@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifndef __linux__
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace effil {
+
+// Blocks threads until notification.
+// Waiter takes epoch, checks its condition and then waits for the next epoch,
+// so notification between the check and the wait is not lost.
+// Futex is used on Linux and condition variable elsewhere.
+class ParkingEvent {
+public:
+    uint32_t epoch() const noexcept { return epoch_.load(std::memory_order_acquire); }
+
+    // Returns when epoch differs from given one (spurious wake ups are possible)
+    void wait(uint32_t epoch) noexcept;
+
+    void notifyOne() noexcept { notify(false); }
+    void notifyAll() noexcept { notify(true); }
+
+private:
+    void notify(bool all) noexcept;
+
+    std::atomic<uint32_t> epoch_ {0};
+    std::atomic<uint32_t> sleepers_ {0};
+#ifndef __linux__
+    std::mutex mutex_;
+    std::condition_variable cv_;
+#endif
+};
+
+// Reader-writer lock with writer preference.
+// New readers don't enter while writer waits, so writers aren't starved by stream of readers.
+// Waiting thread spins for a while and then parks until the lock is released,
+// so contended lock doesn't burn CPU.
+class SharedMutex {
+public:
+    void lock() noexcept {
+        State state = 0;
+        if (!state_.compare_exchange_strong(state, WRITER, std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+            lockSlow();
+    }
+
+    void unlock() noexcept {
+        const State state = state_.fetch_sub(WRITER, std::memory_order_release) - WRITER;
+        if (state != 0)
+            wakeAfterWriter(state);
+    }
+
+    void lock_shared() noexcept {
+        State state = state_.load(std::memory_order_relaxed);
+        if ((state & (WRITER | WAITING_WRITERS_MASK)) != 0 ||
+                !state_.compare_exchange_weak(state, state + READER, std::memory_order_acquire,
+                                              std::memory_order_relaxed))
+            lockSharedSlow();
+    }
+
+    void unlock_shared() noexcept {
+        const State state = state_.fetch_sub(READER, std::memory_order_release) - READER;
+        // the last reader lets waiting writer in
+        if ((state & READERS_MASK) == 0 && (state & WAITING_WRITERS_MASK) != 0)
+            writers_.notifyOne();
+    }
+
+private:
+    typedef uint64_t State;
+
+    // Layout of state_: readers count, waiting writers count, parked readers flag, writer flag.
+    // Counters take 31 bits each, so up to 2^31 - 1 threads may hold or wait for the lock at once.
+    // Overflow of a counter would corrupt the next field, that's why they aren't packed tighter
+    static constexpr State READER = 1;
+    static constexpr State READERS_MASK = (State(1) << 31) - 1;
+    static constexpr State WAITING_WRITER = State(1) << 31;
+    static constexpr State WAITING_WRITERS_MASK = ((State(1) << 62) - 1) & ~READERS_MASK;
+    static constexpr State READERS_PARKED = State(1) << 62;
+    static constexpr State WRITER = State(1) << 63;
+
+    static_assert((READERS_MASK & WAITING_WRITERS_MASK) == 0 &&
+                  ((READERS_MASK | WAITING_WRITERS_MASK) & (READERS_PARKED | WRITER)) == 0 &&
+                  (READERS_MASK | WAITING_WRITERS_MASK | READERS_PARKED | WRITER) == ~State(0),
+                  "fields of lock state overlap");
+    static_assert(WAITING_WRITERS_MASK / WAITING_WRITER == READERS_MASK,
+                  "counters of readers and waiting writers have the same limit");
+
+    void lockSlow() noexcept;
+    void lockSharedSlow() noexcept;
+    void wakeAfterWriter(State state) noexcept;
+
+    std::atomic<State> state_ {0};
+    ParkingEvent readers_;
+    ParkingEvent writers_;
+};
+
+} // effil
@@ -3,15 +3,19 @@
 
 #include "utils.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <limits>
 #include <shared_mutex>
+#include <vector>
 
 namespace effil {
 
 namespace {
 
-typedef std::unique_lock<SpinMutex> UniqueLock;
-typedef std::shared_lock<SpinMutex> SharedLock;
+typedef std::unique_lock<SharedMutex> UniqueLock;
+typedef std::shared_lock<SharedMutex> SharedLock;
 
 template<typename SolObject>
 bool isSharedTable(const SolObject& obj) {
@@ -23,8 +27,191 @@ bool isAnyTable(const SolObject& obj) {
     return obj.valid() && ((obj.get_type() == sol::type::userdata && obj.template is<SharedTable>()) || obj.get_type() == sol::type::table);
 }
 
+// Locks shards in ascending order, so batch operations don't deadlock each other
+template <typename Lock>
+std::vector<Lock> lockShards(SharedTableData& data, std::vector<size_t> indices) {
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+    std::vector<Lock> locks;
+    locks.reserve(indices.size());
+    for (const size_t index : indices)
+        locks.emplace_back(data.shard(index).lock);
+    return locks;
+}
+
+// Numeric value of stored number
+sol::optional<lua_Number> toNumber(const StoredObject& value) {
+    if (const auto number = storedObjectToDouble(value))
+        return *number;
+    if (const auto integer = storedObjectToIndexType(value))
+        return static_cast<lua_Number>(*integer);
+    return sol::nullopt;
+}
+
+// Integer representation of stored number like Lua bitwise operators use
+sol::optional<lua_Integer> toInteger(const StoredObject& value) {
+#if LUA_VERSION_NUM == 503
+    if (value.type() == StoredType::Integer)
+        return *storedObjectToIndexType(value);
+#endif // Lua5.3
+    if (const auto number = storedObjectToDouble(value)) {
+        const auto limit = -static_cast<lua_Number>(std::numeric_limits<lua_Integer>::min());
+        if (std::floor(*number) == *number && *number >= -limit && *number < limit)
+            return static_cast<lua_Integer>(*number);
+    }
+    return sol::nullopt;
+}
+
+// Integers are added with wrap around like in Lua 5.3, other numbers as floats
+StoredObject addNumbers(const StoredObject& left, const StoredObject& right) {
+#if LUA_VERSION_NUM == 503
+    if (left.type() == StoredType::Integer && right.type() == StoredType::Integer) {
+        const auto sum = static_cast<lua_Unsigned>(*storedObjectToIndexType(left)) +
+                         static_cast<lua_Unsigned>(*storedObjectToIndexType(right));
+        return StoredObject::fromInteger(static_cast<lua_Integer>(sum));
+    }
+#endif // Lua5.3
+    return StoredObject::fromNumber(*toNumber(left) + *toNumber(right));
+}
+
+// Raw equality of Lua values, absent value is equal to nil
+bool rawEqual(const StoredObject* current, const StoredObject& expected) {
+    if (expected.type() == StoredType::Nil)
+        return current == nullptr;
+    if (current == nullptr)
+        return false;
+#if LUA_VERSION_NUM == 503
+    if (current->type() == StoredType::Integer && expected.type() == StoredType::Integer)
+        return current->equal(expected);
+#endif // Lua5.3
+    const auto left = toNumber(*current);
+    const auto right = toNumber(expected);
+    if (left && right)
+        return *left == *right;
+    return current->equal(expected);
+}
+
+// Absent object for nil, so the entry is removed
+StoredObject storedValue(const sol::stack_object& value) {
+    return value.valid() ? createStoredObject(value) : StoredObject();
+}
+
+// Shared lock which isn't taken for frozen tables
+class ReadLock {
+public:
+    ReadLock(SharedMutex& mutex, const SharedTableData& data)
+            : mutex_(data.frozen() ? nullptr : &mutex) {
+        if (mutex_)
+            mutex_->lock_shared();
+    }
+
+    ReadLock(ReadLock&& other) noexcept : mutex_(other.mutex_) { other.mutex_ = nullptr; }
+    ~ReadLock() { unlock(); }
+
+    void unlock() {
+        if (mutex_) {
+            mutex_->unlock_shared();
+            mutex_ = nullptr;
+        }
+    }
+
+    ReadLock(const ReadLock&) = delete;
+    ReadLock& operator=(const ReadLock&) = delete;
+    ReadLock& operator=(ReadLock&&) = delete;
+
+private:
+    SharedMutex* mutex_;
+};
+
+std::vector<size_t> allShards(const SharedTableData& data) {
+    std::vector<size_t> indices(data.shardsCount());
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = i;
+    return indices;
+}
+
+std::vector<SharedLock> readLockShards(SharedTableData& data, std::vector<size_t> indices) {
+    if (data.frozen())
+        return {};
+    return lockShards<SharedLock>(data, std::move(indices));
+}
+
+const char* const FROZEN_ERR_MSG = "attempt to modify frozen table";
+
+// Names of Metamethod values
+const char* const METAMETHOD_NAMES[] = {
+    "__index", "__newindex", "__call", "__len", "__tostring", "__pairs", "__ipairs", "__unm", "__eq",
+    "__lt", "__le", "__add", "__sub", "__mul", "__div", "__mod", "__pow", "__concat"
+};
+constexpr size_t METAMETHODS_COUNT = sizeof(METAMETHOD_NAMES) / sizeof(METAMETHOD_NAMES[0]);
+static_assert(METAMETHODS_COUNT == static_cast<size_t>(Metamethod::Concat) + 1, "names don't match Metamethod");
+
+const StoredKeyView& metamethodKey(Metamethod method) {
+    static const std::vector<StoredKeyView> keys = [] {
+        std::vector<StoredKeyView> result;
+        for (const char* name : METAMETHOD_NAMES)
+            result.emplace_back(name);
+        return result;
+    }();
+    return keys[static_cast<size_t>(method)];
+}
+
+sol::optional<Metamethod> metamethodOf(const StoredObject& key) {
+    if (key.type() != StoredType::String || key.stringSize() < 4 || key.stringData()[0] != '_' || key.stringData()[1] != '_')
+        return sol::nullopt;
+    for (size_t i = 0; i < METAMETHODS_COUNT; ++i) {
+        const auto method = static_cast<Metamethod>(i);
+        if (key.equal(metamethodKey(method)))
+            return method;
+    }
+    return sol::nullopt;
+}
+
+// Returns view of metatable if it defines the metamethod.
+// Metatable is referred by the table, so its mask is checked without taking a view
+sol::optional<SharedTable> metatableWith(SharedTableData& data, Metamethod method) {
+    ReadLock lock(data.lock, data);
+    if (data.metatable == GCNull || !static_cast<const SharedTableData*>(data.metatable)->defines(method))
+        return sol::nullopt;
+    return GC::instance().get<SharedTable>(data.metatable);
+}
+
+std::atomic<uint64_t> lastTableId(0);
+
 } // namespace
 
+SharedTableData::SharedTableData()
+        : id(++lastTableId)
+        , shards_(&single_)
+        , shardsCount_(1) {}
+
+void SharedTableData::updateMetamethods(const StoredObject& key, bool defined) {
+    if (const auto method = metamethodOf(key)) {
+        const uint32_t bit = 1u << static_cast<unsigned>(*method);
+        if (defined)
+            metamethods_.fetch_or(bit, std::memory_order_release);
+        else
+            metamethods_.fetch_and(~bit, std::memory_order_release);
+    }
+}
+
+uint64_t SharedTableData::version() const {
+    uint64_t result = metatableVersion_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < shardsCount_; ++i)
+        result += shards_[i].version.load(std::memory_order_relaxed);
+    return result;
+}
+
+void SharedTableData::split(size_t count) {
+    assert(count > 0);
+    if (count == 1)
+        return;
+    split_.reset(new Shard[count]);
+    shards_ = split_.get();
+    shardsCount_ = count;
+}
+
 void SharedTable::exportAPI(sol::state_view& lua) {
     sol::usertype<SharedTable> type("new", sol::no_constructor,
         "__pairs",  &SharedTable::luaPairs,
@@ -51,24 +238,49 @@ void SharedTable::exportAPI(sol::state_view& lua) {
 }
 
 void SharedTable::set(StoredObject&& key, StoredObject&& value) {
-    UniqueLock g(ctx_->lock);
-
-    ctx_->addReference(key->gcHandle());
-    ctx_->addReference(value->gcHandle());
+    auto& shard = ctx_->shardOf(key);
+    UniqueLock g(shard.lock);
+    setEntry(shard, std::move(key), std::move(value));
+}
 
-    key->releaseStrongReference();
-    value->releaseStrongReference();
+// Shard must be locked
+void SharedTable::setEntry(SharedTableData::Shard& shard, StoredObject&& key, StoredObject&& value) {
+    REQUIRE(!ctx_->frozen()) << FROZEN_ERR_MSG;
+    ctx_->addReference(value.gcHandle());
+    value.releaseStrongReference();
 
-    ctx_->entries[std::move(key)] = std::move(value);
+    if (StoredObject* current = shard.entries.find(key)) {
+        // existing key is kept, previous value is not referenced anymore
+        ctx_->removeReference(current->gcHandle());
+        *current = std::move(value);
+    } else {
+        ctx_->addReference(key.gcHandle());
+        key.releaseStrongReference();
+        ctx_->updateMetamethods(key, true);
+        shard.entries.insert(std::move(key), std::move(value));
+    }
+    ctx_->modified(shard);
 }
 
 sol::object SharedTable::get(const StoredObject& key, sol::this_state state) const {
-    SharedLock g(ctx_->lock);
-    const auto val = ctx_->entries.find(key);
-    if (val == ctx_->entries.end()) {
+    auto& shard = ctx_->shardOf(key);
+    ReadLock g(shard.lock, *ctx_);
+    const auto val = shard.entries.find(key);
+    if (val == nullptr) {
+        return sol::nil;
+    } else {
+        return val->unpack(state);
+    }
+}
+
+sol::object SharedTable::get(const StoredKeyView& key, sol::this_state state) const {
+    auto& shard = ctx_->shardOf(key);
+    ReadLock g(shard.lock, *ctx_);
+    const auto val = shard.entries.find(key);
+    if (val == nullptr) {
         return sol::nil;
     } else {
-        return val->second->unpack(state);
+        return val->unpack(state);
     }
 }
 
@@ -77,70 +289,394 @@ void SharedTable::rawSet(const sol::stack_object& luaKey, const sol::stack_objec
 
     StoredObject key = createStoredObject(luaKey);
     if (luaValue.get_type() == sol::type::nil) {
-        UniqueLock g(ctx_->lock);
-
-        // in this case object is not obligatory to own data
-        auto it = ctx_->entries.find(key);
-        if (it != ctx_->entries.end()) {
-            ctx_->removeReference(it->first->gcHandle());
-            ctx_->removeReference(it->second->gcHandle());
-            ctx_->entries.erase(it);
-        }
-
+        auto& shard = ctx_->shardOf(key);
+        UniqueLock g(shard.lock);
+        eraseEntry(shard, key);
     } else {
         set(std::move(key), createStoredObject(luaValue));
     }
 }
 
+// Shard must be locked
+void SharedTable::eraseEntry(SharedTableData::Shard& shard, const StoredObject& key) {
+    REQUIRE(!ctx_->frozen()) << FROZEN_ERR_MSG;
+    // in this case object is not obligatory to own data
+    if (const StoredObject removed = shard.entries.erase(key)) {
+        ctx_->updateMetamethods(key, false);
+        ctx_->removeReference(key.gcHandle());
+        ctx_->removeReference(removed.gcHandle());
+        ctx_->modified(shard);
+    }
+}
+
+template <typename Func>
+void SharedTable::update(const sol::stack_object& luaKey, const Func& func) {
+    REQUIRE(luaKey.valid()) << "Indexing by nil";
+    const StoredKeyView view(luaKey);
+    StoredObject key = view.valid() ? StoredObject() : createStoredObject(luaKey);
+    auto& shard = view.valid() ? ctx_->shardOf(view) : ctx_->shardOf(key);
+
+    UniqueLock g(shard.lock);
+    REQUIRE(!ctx_->frozen()) << FROZEN_ERR_MSG;
+    StoredObject* current = view.valid() ? shard.entries.find(view) : shard.entries.find(key);
+    StoredObject replacement;
+    if (!func(static_cast<const StoredObject*>(current), replacement))
+        return;
+
+    if (current != nullptr && replacement) {
+        // existing entry is updated in place
+        ctx_->addReference(replacement.gcHandle());
+        replacement.releaseStrongReference();
+        ctx_->removeReference(current->gcHandle());
+        *current = std::move(replacement);
+        ctx_->modified(shard);
+        return;
+    }
+
+    if (!key)
+        key = createStoredObject(luaKey);
+    if (replacement)
+        setEntry(shard, std::move(key), std::move(replacement));
+    else
+        eraseEntry(shard, key);
+}
+
 sol::object SharedTable::rawGet(const sol::stack_object& luaKey, sol::this_state state) const {
     REQUIRE(luaKey.valid()) << "Indexing by nil";
-    StoredObject key = createStoredObject(luaKey);
-    return get(key, state);
+    const StoredKeyView key(luaKey);
+    if (key.valid())
+        return get(key, state);
+    // there is no view for such keys, they are rare
+    return get(createStoredObject(luaKey), state);
 }
 
-sol::object SharedTable::luaDump(sol::this_state state, BaseHolder::DumpCache& cache) const {
-    const auto iter = cache.find(handle());
-    if (iter == cache.end()) {
-        SharedLock lock(ctx_->lock);
+// Keys are read like ipairs does, values are returned in Lua table by the same keys
+sol::object SharedTable::getMany(const sol::stack_object& keys, sol::this_state state) const {
+    lua_State* L = state;
+    const int keysIndex = keys.stack_index();
 
-        auto result = sol::table::create(state.L);
-        cache.insert(iter, {handle(), result.registry_index()});
-        for (const auto& pair: ctx_->entries) {
-            result.set(pair.first->convertToLua(state, cache),
-                       pair.second->convertToLua(state, cache));
+    struct Key {
+        StoredKeyView view;
+        StoredObject stored; // keys without view
+    };
+    std::vector<Key> batch;
+    std::vector<size_t> shards;
+    // views refer to strings owned by keys table, so keys may be popped from the stack
+    for (int i = 1; ; ++i) {
+        lua_rawgeti(L, keysIndex, i);
+        const sol::stack_object luaKey(L, lua_gettop(L));
+        if (!luaKey.valid()) {
+            lua_pop(L, 1);
+            break;
         }
-        if (ctx_->metatable) {
-            const auto mt = GC::instance().get<SharedTable>(ctx_->metatable);
-            lock.unlock();
+        const StoredKeyView view(luaKey);
+        batch.push_back(Key{view, view.valid() ? StoredObject() : createStoredObject(luaKey)});
+        lua_pop(L, 1);
+        shards.push_back(view.valid() ? ctx_->shardIndex(view) : ctx_->shardIndex(batch.back().stored));
+    }
 
-            result[sol::metatable_key] = mt.luaDump(state, cache);
+    sol::table result = sol::table::create(L, 0, static_cast<int>(batch.size()));
+    result.push();
+    const int resultIndex = lua_gettop(L);
+    {
+        const auto locks = readLockShards(*ctx_, shards);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            const auto& entries = ctx_->shard(shards[i]).entries;
+            const StoredObject* value = batch[i].view.valid() ? entries.find(batch[i].view)
+                                                              : entries.find(batch[i].stored);
+            if (value == nullptr)
+                continue;
+            lua_rawgeti(L, keysIndex, static_cast<int>(i + 1));
+            value->unpack(state).push(L);
+            lua_rawset(L, resultIndex);
         }
-        return result;
     }
-    return sol::table(state.L, sol::ref_index(iter->second));
+    lua_pop(L, 1);
+    return result;
+}
+
+// All entries are converted before the table is locked
+void SharedTable::setMany(const sol::stack_object& values) {
+    lua_State* L = values.lua_state();
+    const int valuesIndex = values.stack_index();
+
+    std::vector<std::pair<StoredObject, StoredObject>> batch;
+    std::vector<size_t> shards;
+    SolTableToShared visited;
+    lua_pushnil(L);
+    while (lua_next(L, valuesIndex) != 0) {
+        const int top = lua_gettop(L);
+        StoredObject key = createStoredObject(sol::stack_object(L, top - 1), visited);
+        StoredObject value = createStoredObject(sol::stack_object(L, top), visited);
+        shards.push_back(ctx_->shardIndex(key));
+        batch.emplace_back(std::move(key), std::move(value));
+        lua_pop(L, 1);
+    }
+
+    const auto locks = lockShards<UniqueLock>(*ctx_, shards);
+    for (size_t i = 0; i < batch.size(); ++i)
+        setEntry(ctx_->shard(shards[i]), std::move(batch[i].first), std::move(batch[i].second));
+}
+
+namespace {
+
+// Adds tables which are converted by dump along with the object.
+// Upvalues of functions are immutable, function may capture itself
+void addDumpedTables(const StoredObject& object, std::vector<GCHandle>& tables) {
+    if (object.type() == StoredType::SharedTable) {
+        tables.push_back(object.gcHandle());
+        return;
+    }
+    if (object.type() != StoredType::Function)
+        return;
+
+    std::vector<GCHandle> functions = {object.gcHandle()};
+    for (size_t i = 0; i < functions.size(); ++i) {
+        for (const StoredObject& upvalue : static_cast<const FunctionData*>(functions[i])->upvalues) {
+            if (upvalue.type() == StoredType::SharedTable)
+                tables.push_back(upvalue.gcHandle());
+            else if (upvalue.type() == StoredType::Function &&
+                     std::find(functions.begin(), functions.end(), upvalue.gcHandle()) == functions.end())
+                functions.push_back(upvalue.gcHandle());
+        }
+    }
+}
+
+void sortUnique(std::vector<GCHandle>& handles) {
+    std::sort(handles.begin(), handles.end());
+    handles.erase(std::unique(handles.begin(), handles.end()), handles.end());
+}
+
+// Registry table which maps results of dump to their records.
+// Record is a table {snapshot, tables}, where tables maps handles to Lua tables of the result.
+// Records don't keep results alive, so both keys and tables of records are weak
+const char* const DUMPS_KEY = "effil.dumps";
+
+void pushWeakTable(lua_State* L, const char* mode) {
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushstring(L, mode);
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+}
+
+void pushDumps(lua_State* L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, DUMPS_KEY);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        pushWeakTable(L, "k");
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, DUMPS_KEY);
+    }
+}
+
+void saveDumpRecord(lua_State* L, const sol::table& result,
+                    const StoredObject::DumpCache& cache, DumpSnapshot&& snapshot) {
+    pushDumps(L);
+    sol::stack::push(L, result);
+    lua_createtable(L, 2, 0);
+    sol::stack::push(L, std::move(snapshot));
+    lua_rawseti(L, -2, 1);
+    pushWeakTable(L, "v");
+    for (const auto& entry : cache.tables) {
+        lua_pushlightuserdata(L, entry.first);
+        sol::stack::push(L, entry.second);
+        lua_rawset(L, -3);
+    }
+    lua_rawseti(L, -2, 2);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+}
+
+} // namespace
+
+sol::object SharedTable::luaDump(sol::this_state state, StoredObject::DumpCache& cache) const {
+    const auto iter = cache.tables.find(handle());
+    if (iter != cache.tables.end())
+        return iter->second;
+
+    auto result = sol::table::create(state.L);
+    cache.tables.emplace(handle(), result);
+    DumpSnapshot::Node node{ctx_->id, 0, {}};
+    for (size_t i = 0; i < ctx_->shardsCount(); ++i) {
+        auto& shard = ctx_->shard(i);
+        ReadLock lock(shard.lock, *ctx_);
+        node.version += shard.version.load(std::memory_order_relaxed);
+        shard.entries.forEach([&](const StoredObject* key, size_t index, const StoredObject& value) {
+            if (cache.snapshot) {
+                if (key)
+                    addDumpedTables(*key, node.children);
+                addDumpedTables(value, node.children);
+            }
+            if (key)
+                result.set(key->convertToLua(state, cache), value.convertToLua(state, cache));
+            else
+                result.set(static_cast<LUA_INDEX_TYPE>(index), value.convertToLua(state, cache));
+        });
+    }
+
+    ReadLock lock(ctx_->lock, *ctx_);
+    node.version += ctx_->metatableVersion();
+    if (ctx_->metatable) {
+        const auto mt = GC::instance().get<SharedTable>(ctx_->metatable);
+        lock.unlock();
+
+        node.children.push_back(mt.handle());
+        result[sol::metatable_key] = mt.luaDump(state, cache);
+    }
+    if (cache.snapshot) {
+        sortUnique(node.children);
+        cache.snapshot->nodes[handle()] = std::move(node);
+    }
+    return result;
+}
+
+// Tables of previous result are reused if they and all tables reachable from them
+// have the same versions as at the previous dump,
+// so only changed tables and tables which refer to them are converted again.
+// Graph of tables is recorded only for incremental dumps, plain dump doesn't pay for it
+sol::object SharedTable::luaDump(sol::this_state state, const sol::stack_object& previous) const {
+    StoredObject::DumpCache cache;
+    if (!previous.valid())
+        return luaDump(state, cache);
+
+    lua_State* L = state;
+    DumpSnapshot snapshot;
+    cache.snapshot = &snapshot;
+
+    std::vector<SharedTable> reused;
+    if (previous.get_type() == sol::type::table) {
+        pushDumps(L);
+        lua_pushvalue(L, previous.stack_index());
+        lua_rawget(L, -2);
+        const auto record = sol::stack::pop<sol::object>(L);
+        lua_pop(L, 1);
+        // previous table may be not a result of dump
+        if (record.get_type() == sol::type::table) {
+            const auto recordTable = record.as<sol::table>();
+            const auto previousSnapshot = recordTable.raw_get<sol::object>(1);
+            if (previousSnapshot.is<DumpSnapshot>())
+                reused = reuseDumped(previousSnapshot.as<DumpSnapshot&>(), recordTable.raw_get<sol::table>(2), cache);
+        }
+    }
+
+    const auto result = luaDump(state, cache).as<sol::table>();
+    saveDumpRecord(L, result, cache, std::move(snapshot));
+    return result;
+}
+
+// Reused tables are returned to be kept alive until the dump is finished,
+// otherwise handle of deleted table may be taken by new one and found in the cache
+std::vector<SharedTable> SharedTable::reuseDumped(const DumpSnapshot& previous, const sol::table& previousTables,
+                                                  StoredObject::DumpCache& cache) const {
+    constexpr size_t NO_PARENT = std::numeric_limits<size_t>::max();
+    struct Node {
+        SharedTable table;
+        std::vector<size_t> parents;
+        sol::table dumped; // table of previous result, invalid if the table has to be converted again
+    };
+    std::vector<Node> nodes;
+    std::unordered_map<GCHandle, size_t> indices;
+    std::vector<size_t> changed;
+
+    const auto visit = [&](const SharedTable& table, size_t parent) {
+        const auto inserted = indices.emplace(table.handle(), nodes.size());
+        if (inserted.second)
+            nodes.push_back(Node{table, {}, sol::table()});
+        if (parent != NO_PARENT)
+            nodes[inserted.first->second].parents.push_back(parent);
+    };
+
+    // Children of unchanged tables are taken from the snapshot, so their entries aren't read
+    lua_State* L = previousTables.lua_state();
+    visit(*this, NO_PARENT);
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const SharedTable table = nodes[i].table;
+        SharedTableData& data = *table.ctx_;
+        std::vector<SharedTable> children;
+        bool unchanged;
+        {
+            ReadLock metatableLock(data.lock, data);
+            const auto locks = readLockShards(data, allShards(data));
+            const auto recorded = previous.nodes.find(table.handle());
+            unchanged = recorded != previous.nodes.end() && recorded->second.id == data.id &&
+                        recorded->second.version == data.version();
+
+            std::vector<GCHandle> handles;
+            if (unchanged) {
+                handles = recorded->second.children;
+            } else {
+                for (size_t s = 0; s < data.shardsCount(); ++s) {
+                    data.shard(s).entries.forEach([&](const StoredObject* key, size_t, const StoredObject& value) {
+                        if (key)
+                            addDumpedTables(*key, handles);
+                        addDumpedTables(value, handles);
+                    });
+                }
+                if (data.metatable != GCNull)
+                    handles.push_back(data.metatable);
+                sortUnique(handles);
+            }
+            // children are referred by the locked table, so they are alive
+            for (const GCHandle child : handles)
+                children.push_back(GC::instance().get<SharedTable>(child));
+        }
+
+        if (unchanged) {
+            sol::stack::push(L, previousTables);
+            lua_pushlightuserdata(L, table.handle());
+            lua_rawget(L, -2);
+            const auto dumped = sol::stack::pop<sol::object>(L);
+            lua_pop(L, 1);
+            // table of the result is collected if it isn't referred anymore
+            if (dumped.get_type() == sol::type::table)
+                nodes[i].dumped = dumped.as<sol::table>();
+        }
+        if (!nodes[i].dumped.valid())
+            changed.push_back(i);
+        for (const SharedTable& child : children)
+            visit(child, i);
+    }
+
+    // Tables which refer to changed ones have to be converted again
+    while (!changed.empty()) {
+        const size_t i = changed.back();
+        changed.pop_back();
+        for (const size_t parent : nodes[i].parents) {
+            if (nodes[parent].dumped.valid()) {
+                nodes[parent].dumped = sol::table();
+                changed.push_back(parent);
+            }
+        }
+    }
+
+    std::vector<SharedTable> reused;
+    for (const Node& node : nodes) {
+        if (node.dumped.valid()) {
+            cache.tables.emplace(node.table.handle(), node.dumped);
+            cache.snapshot->nodes.emplace(node.table.handle(), previous.nodes.at(node.table.handle()));
+            reused.push_back(node.table);
+        }
+    }
+    return reused;
 }
 
 /*
  * Lua Meta API methods
  */
 #define DEFFINE_METAMETHOD_CALL_0(methodName) DEFFINE_METAMETHOD_CALL(methodName, *this)
-#define DEFFINE_METAMETHOD_CALL(methodName, ...) \
-    { \
-        SharedLock lock(ctx_->lock); \
-        if (ctx_->metatable != GCNull) { \
-            auto tableHolder = GC::instance().get<SharedTable>(ctx_->metatable); \
-            lock.unlock(); \
-            sol::function handler = tableHolder.get(createStoredObject(methodName), state); \
-            if (handler.valid()) { \
-                return handler(__VA_ARGS__); \
-            } \
+#define DEFFINE_METAMETHOD_CALL(method, ...) \
+    if (const auto metatable = metatableWith(*ctx_, method)) { \
+        sol::function handler = metatable->get(metamethodKey(method), state); \
+        if (handler.valid()) { \
+            return handler(__VA_ARGS__); \
         } \
     }
 
-#define PROXY_METAMETHOD_IMPL(tableMethod, methodName, errMsg) \
+#define PROXY_METAMETHOD_IMPL(tableMethod, method, errMsg) \
     sol::object SharedTable:: tableMethod(sol::this_state state, \
             const sol::stack_object& leftObject, const sol::stack_object& rightObject) { \
-        return basicBinaryMetaMethod(methodName, errMsg, state, leftObject, rightObject); \
+        return basicBinaryMetaMethod(method, errMsg, state, leftObject, rightObject); \
     }
 
 namespace {
@@ -149,30 +685,30 @@ const std::string COMPARE_ERR_MSG = "attempt to compare a effil::table value";
 const std::string CONCAT_ERR_MSG = "attempt to concatenate a effil::table value";
 }
 
-sol::object SharedTable::basicBinaryMetaMethod(const std::string& metamethodName, const std::string& errMsg,
+sol::object SharedTable::basicBinaryMetaMethod(Metamethod metamethod, const std::string& errMsg,
             sol::this_state state, const sol::stack_object& leftObject, const sol::stack_object& rightObject) {
     if (isSharedTable(leftObject)) {
         SharedTable table = leftObject.as<SharedTable>();
         auto ctx_ = table.ctx_;
-        DEFFINE_METAMETHOD_CALL(metamethodName, table, rightObject)
+        DEFFINE_METAMETHOD_CALL(metamethod, table, rightObject)
     }
     if (isSharedTable(rightObject)) {
         SharedTable table = rightObject.as<SharedTable>();
         auto ctx_ = table.ctx_;
-        DEFFINE_METAMETHOD_CALL(metamethodName, leftObject, table)
+        DEFFINE_METAMETHOD_CALL(metamethod, leftObject, table)
     }
     throw Exception() << errMsg;
 }
 
-PROXY_METAMETHOD_IMPL(luaConcat, "__concat", CONCAT_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaAdd, "__add", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaSub, "__sub", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaMul, "__mul", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaDiv, "__div", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaMod, "__mod", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaPow, "__pow", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaLe, "__le", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaLt, "__lt", ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaConcat, Metamethod::Concat, CONCAT_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaAdd, Metamethod::Add, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaSub, Metamethod::Sub, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaMul, Metamethod::Mul, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaDiv, Metamethod::Div, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaMod, Metamethod::Mod, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaPow, Metamethod::Pow, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaLe, Metamethod::Le, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaLt, Metamethod::Lt, ARITHMETIC_ERR_MSG)
 
 sol::object SharedTable::luaEq(sol::this_state state, const sol::stack_object& leftObject,
                                const sol::stack_object& rightObject) {
@@ -180,12 +716,12 @@ sol::object SharedTable::luaEq(sol::this_state state, const sol::stack_object& l
         {
             SharedTable table = leftObject.as<SharedTable>();
             auto ctx_ = table.ctx_;
-            DEFFINE_METAMETHOD_CALL("__eq", table, rightObject)
+            DEFFINE_METAMETHOD_CALL(Metamethod::Eq, table, rightObject)
         }
         {
             SharedTable table = rightObject.as<SharedTable>();
             auto ctx_ = table.ctx_;
-            DEFFINE_METAMETHOD_CALL("__eq", leftObject, table)
+            DEFFINE_METAMETHOD_CALL(Metamethod::Eq, leftObject, table)
         }
         const bool isEqual = leftObject.as<SharedTable>().handle() == rightObject.as<SharedTable>().handle();
         return sol::make_object(state, isEqual);
@@ -194,21 +730,16 @@ sol::object SharedTable::luaEq(sol::this_state state, const sol::stack_object& l
 }
 
 sol::object SharedTable::luaUnm(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__unm")
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::Unm)
     throw Exception() << ARITHMETIC_ERR_MSG;
 }
 
 void SharedTable::luaNewIndex(const sol::stack_object& luaKey, const sol::stack_object& luaValue, sol::this_state state) {
-    {
-        SharedLock lock(ctx_->lock);
-        if (ctx_->metatable != GCNull) {
-            auto tableHolder = GC::instance().get<SharedTable>(ctx_->metatable);
-            lock.unlock();
-            sol::function handler = tableHolder.get(createStoredObject("__newindex"), state);
-            if (handler.valid()) {
-                handler(*this, luaKey, luaValue);
-                return;
-            }
+    if (const auto metatable = metatableWith(*ctx_, Metamethod::NewIndex)) {
+        sol::function handler = metatable->get(metamethodKey(Metamethod::NewIndex), state);
+        if (handler.valid()) {
+            handler(*this, luaKey, luaValue);
+            return;
         }
     }
     try {
@@ -219,25 +750,22 @@ void SharedTable::luaNewIndex(const sol::stack_object& luaKey, const sol::stack_
 sol::object SharedTable::luaIndex(const sol::stack_object& luaKey, sol::this_state state) const {
     REQUIRE(luaKey.valid()) << "Indexing by nil";
     try {
-        StoredObject key = createStoredObject(luaKey);
-        if (sol::object result = get(key, state)) {
+        if (sol::object result = rawGet(luaKey, state)) {
             return result;
         }
     } RETHROW_WITH_PREFIX("effil.table");
 
-    SharedLock lock(ctx_->lock);
-    if (ctx_->metatable != GCNull) {
-        const auto tableHolder = GC::instance().get<SharedTable>(ctx_->metatable);
-        lock.unlock();
-
-        SharedLock mt_lock(tableHolder.ctx_->lock);
-        const auto iter = tableHolder.ctx_->entries.find(createStoredObject("__index"));
-        if (iter != tableHolder.ctx_->entries.end()) {
-            if (const auto tbl = storedObjectTo<SharedTable>(iter->second)) {
+    if (const auto tableHolder = metatableWith(*ctx_, Metamethod::Index)) {
+        const StoredKeyView& indexKey = metamethodKey(Metamethod::Index);
+        auto& shard = tableHolder->ctx_->shardOf(indexKey);
+        ReadLock mt_lock(shard.lock, *tableHolder->ctx_);
+        const auto handler = shard.entries.find(indexKey);
+        if (handler != nullptr) {
+            if (const auto tbl = storedObjectTo<SharedTable>(*handler)) {
                 mt_lock.unlock();
                 return tbl->luaIndex(luaKey, state);
             }
-            else if (const auto func = storedObjectTo<Function>(iter->second)) {
+            else if (const auto func = storedObjectTo<Function>(*handler)) {
                 mt_lock.unlock();
                 return func->loadFunction(state).as<sol::function>()(*this, luaKey);
             }
@@ -247,11 +775,8 @@ sol::object SharedTable::luaIndex(const sol::stack_object& luaKey, sol::this_sta
 }
 
 StoredArray SharedTable::luaCall(sol::this_state state, const sol::variadic_args& args) {
-    SharedLock lock(ctx_->lock);
-    if (ctx_->metatable != GCNull) {
-        auto metatable = GC::instance().get<SharedTable>(ctx_->metatable);
-        sol::function handler = metatable.get(createStoredObject(std::string("__call")), state);
-        lock.unlock();
+    if (const auto metatable = metatableWith(*ctx_, Metamethod::Call)) {
+        sol::function handler = metatable->get(metamethodKey(Metamethod::Call), state);
         if (handler.valid()) {
             StoredArray storedResults;
             const int savedStackTop = lua_gettop(state);
@@ -267,69 +792,173 @@ StoredArray SharedTable::luaCall(sol::this_state state, const sol::variadic_args
 }
 
 sol::object SharedTable::luaToString(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__tostring");
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::ToString);
     std::stringstream ss;
     ss << "effil.table: " << ctx_.get();
     return sol::make_object(state, ss.str());
 }
 
 sol::object SharedTable::luaLength(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__len");
-    SharedLock g(ctx_->lock);
-    size_t len = 0u;
-    sol::optional<LUA_INDEX_TYPE> value;
-    auto iter = ctx_->entries.find(createStoredObject(static_cast<LUA_INDEX_TYPE>(1)));
-    if (iter != ctx_->entries.end()) {
-        do {
-            ++len;
-            ++iter;
-        } while ((iter != ctx_->entries.end()) && (value = storedObjectToIndexType(iter->first)) &&
-                 (static_cast<size_t>(value.value()) == len + 1));
-    }
-    return sol::make_object(state, len);
-}
-
-SharedTable::PairsIterator SharedTable::getNext(const sol::object& key, sol::this_state lua) const {
-    SharedLock g(ctx_->lock);
-    if (key) {
-        auto obj = createStoredObject(key);
-        auto upper = ctx_->entries.upper_bound(obj);
-        if (upper != ctx_->entries.end())
-            return PairsIterator(upper->first->unpack(lua), upper->second->unpack(lua));
-    } else {
-        if (!ctx_->entries.empty()) {
-            const auto& begin = ctx_->entries.begin();
-            return PairsIterator(begin->first->unpack(lua), begin->second->unpack(lua));
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::Len);
+    return sol::make_object(state, length());
+}
+
+size_t SharedTable::length() const {
+    if (ctx_->shardsCount() == 1) {
+        auto& shard = ctx_->shard(0);
+        ReadLock g(shard.lock, *ctx_);
+        return shard.entries.length();
+    }
+
+    // Indices are spread over shards, so border is found by unbound search like in Lua
+    const auto present = [&](size_t index) {
+        const StoredKeyView key(static_cast<LUA_INDEX_TYPE>(index));
+        auto& shard = ctx_->shardOf(key);
+        ReadLock g(shard.lock, *ctx_);
+        return shard.entries.find(key) != nullptr;
+    };
+
+    constexpr size_t MAX_INDEX = static_cast<size_t>(1) << 52;
+    size_t i = 0;
+    size_t j = 1;
+    while (j < MAX_INDEX && present(j)) {
+        i = j;
+        j *= 2;
+    }
+    // t[i] is presented (or i is 0) and t[j] is absent
+    while (j - i > 1) {
+        const size_t middle = i + (j - i) / 2;
+        if (present(middle))
+            i = middle;
+        else
+            j = middle;
+    }
+    return i;
+}
+
+SharedTable::PairsIterator SharedTable::getNext(const sol::stack_object& key, sol::this_state lua) const {
+    const StoredKeyView keyView(key);
+    // keys without view have to be stored to be found, nil key starts iteration
+    const StoredObject storedKey = key.valid() && !keyView.valid() ? createStoredObject(key) : StoredObject();
+
+    // shards are iterated one by one
+    size_t index = keyView.valid() ? ctx_->shardIndex(keyView) : storedKey ? ctx_->shardIndex(storedKey) : 0;
+    for (bool first = true; index < ctx_->shardsCount(); ++index, first = false) {
+        auto& shard = ctx_->shard(index);
+        ReadLock g(shard.lock, *ctx_);
+        StoredObjectMap::Item next;
+        bool found;
+        if (!first || !key.valid())
+            found = shard.entries.next(static_cast<const StoredObject*>(nullptr), next);
+        else if (cursor_.shard == index && (keyView.valid() ? shard.entries.isAt(cursor_.position, keyView)
+                                                            : shard.entries.isAt(cursor_.position, storedKey)))
+            found = shard.entries.nextFrom(cursor_.position, next);
+        else if (keyView.valid())
+            found = shard.entries.next(&keyView, next);
+        else
+            found = shard.entries.next(&storedKey, next);
+
+        if (found) {
+            cursor_.shard = index;
+            cursor_.position = next.position;
+            const sol::object nextKey = next.key ? next.key->unpack(lua)
+                                                 : sol::make_object(lua, static_cast<LUA_INDEX_TYPE>(next.index));
+            return PairsIterator(nextKey, next.value->unpack(lua));
         }
     }
+    cursor_ = Cursor();
     return PairsIterator(sol::nil, sol::nil);
 }
 
+// Table is passed by reference, so cursor of its view is kept between steps
+SharedTable::PairsIterator SharedTable::luaPairsNext(sol::this_state lua, const SharedTable& table,
+                                                     const sol::stack_object& key) {
+    return table.getNext(key, lua);
+}
+
 SharedTable::PairsIterator SharedTable::luaPairs(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__pairs");
-    auto next = [](sol::this_state state, SharedTable table, sol::stack_object key) { return table.getNext(key, state); };
-    return PairsIterator(
-        sol::make_object(state, std::function<PairsIterator(sol::this_state state, SharedTable table, sol::stack_object key)>(next)).as<sol::function>(),
-        sol::make_object(state, *this));
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::Pairs);
+    return PairsIterator(sol::make_object(state, &SharedTable::luaPairsNext).as<sol::function>(),
+                         sol::make_object(state, *this));
+}
+
+namespace {
+
+// Upvalues are snapshot {key1, value1, key2, value2, ...} and index of the next key in it
+int snapshotNext(lua_State* L) {
+    const int index = static_cast<int>(lua_tointeger(L, lua_upvalueindex(2)));
+    lua_rawgeti(L, lua_upvalueindex(1), index);
+    if (lua_isnil(L, -1))
+        return 1;
+    lua_rawgeti(L, lua_upvalueindex(1), index + 1);
+    lua_pushinteger(L, index + 2);
+    lua_replace(L, lua_upvalueindex(2));
+    return 2;
+}
+
+} // namespace
+
+// Entries are copied under locks of all shards, then iteration doesn't touch the table
+SharedTable::PairsIterator SharedTable::snapshotPairs(sol::this_state state) const {
+    lua_State* L = state;
+    sol::table snapshot;
+    {
+        const auto locks = readLockShards(*ctx_, allShards(*ctx_));
+        size_t size = 0;
+        for (size_t i = 0; i < ctx_->shardsCount(); ++i)
+            size += ctx_->shard(i).entries.size();
+
+        snapshot = sol::table::create(L, static_cast<int>(size * 2), 0);
+        snapshot.push();
+        const int snapshotIndex = lua_gettop(L);
+        int position = 0;
+        for (size_t i = 0; i < ctx_->shardsCount(); ++i) {
+            ctx_->shard(i).entries.forEach([&](const StoredObject* key, size_t index, const StoredObject& value) {
+                if (key)
+                    key->unpack(state).push(L);
+                else
+                    sol::stack::push(L, static_cast<LUA_INDEX_TYPE>(index));
+                lua_rawseti(L, snapshotIndex, ++position);
+                value.unpack(state).push(L);
+                lua_rawseti(L, snapshotIndex, ++position);
+            });
+        }
+        lua_pop(L, 1);
+    }
+
+    snapshot.push();
+    lua_pushinteger(L, 1);
+    lua_pushcclosure(L, snapshotNext, 2);
+    return PairsIterator(sol::stack::pop<sol::object>(L), sol::nil);
+}
+
+sol::object SharedTable::getIndex(size_t index, sol::this_state state) const {
+    if (ctx_->shardsCount() == 1) {
+        auto& shard = ctx_->shard(0);
+        ReadLock g(shard.lock, *ctx_);
+        const auto value = shard.entries.findIndex(index);
+        return value ? value->unpack(state) : sol::nil;
+    }
+    return get(StoredKeyView(static_cast<LUA_INDEX_TYPE>(index)), state);
 }
 
 std::pair<sol::object, sol::object> ipairsNext(sol::this_state lua, SharedTable table, const sol::optional<LUA_INDEX_TYPE>& key) {
-    size_t index = key ? key.value() + 1 : 1;
-    auto objKey = createStoredObject(static_cast<LUA_INDEX_TYPE>(index));
-    sol::object value = table.get(objKey, lua);
+    size_t index = key ? static_cast<size_t>(key.value()) + 1 : 1;
+    sol::object value = table.getIndex(index, lua);
     if (!value.valid())
         return std::pair<sol::object, sol::object>(sol::nil, sol::nil);
-    return std::pair<sol::object, sol::object>(objKey->unpack(lua), value);
+    return std::pair<sol::object, sol::object>(sol::make_object(lua, static_cast<LUA_INDEX_TYPE>(index)), value);
 }
 
 SharedTable::PairsIterator SharedTable::luaIPairs(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__ipairs");
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::IPairs);
     return PairsIterator(sol::make_object(state, ipairsNext).as<sol::function>(),
                 sol::make_object(state, *this));
 }
 
 SharedTable SharedTable::setMetatable(const sol::optional<SharedTable>& metaTable) {
     UniqueLock lock(ctx_->lock);
+    REQUIRE(!ctx_->frozen()) << FROZEN_ERR_MSG;
     if (ctx_->metatable != GCNull) {
         ctx_->removeReference(ctx_->metatable);
         ctx_->metatable = GCNull;
@@ -339,6 +968,7 @@ SharedTable SharedTable::setMetatable(const sol::optional<SharedTable>& metaTabl
         ctx_->metatable = metaTable->handle();
         ctx_->addReference(ctx_->metatable);
     }
+    ctx_->metatableModified();
     return *this;
 }
 
@@ -355,19 +985,21 @@ SharedTable SharedTable::luaSetMetatable(const sol::stack_object& tbl, const sol
         << luaTypename(mt) << ")";
 
     SolTableToShared cache;
-    SharedTable table = GC::instance().get<SharedTable>(createStoredObject(tbl, cache)->gcHandle());
+    SharedTable table = GC::instance().get<SharedTable>(createStoredObject(tbl, cache).gcHandle());
     sol::optional<SharedTable> metatable;
     if (mt.valid()) {
-        metatable = GC::instance().get<SharedTable>(createStoredObject(mt, cache)->gcHandle());
+        metatable = GC::instance().get<SharedTable>(createStoredObject(mt, cache).gcHandle());
     }
-    return table.setMetatable(metatable);
+    try {
+        return table.setMetatable(metatable);
+    } RETHROW_WITH_PREFIX("effil.setmetatable");
 }
 
 sol::object SharedTable::luaGetMetatable(const sol::stack_object& tbl, sol::this_state state) {
     REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.getmetatable' (effil.table expected, got " << luaTypename(tbl) << ")";
     auto& stable = tbl.as<SharedTable>();
 
-    SharedLock lock(stable.ctx_->lock);
+    ReadLock lock(stable.ctx_->lock, *stable.ctx_);
     return stable.ctx_->metatable == GCNull ? sol::nil :
             sol::make_object(state, GC::instance().get<SharedTable>(stable.ctx_->metatable));
 }
@@ -392,14 +1024,80 @@ size_t SharedTable::luaSize(const sol::stack_object& tbl) {
     REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.size' (effil.table expected, got " << luaTypename(tbl) << ")";
     try {
         auto& stable = tbl.as<SharedTable>();
-        SharedLock g(stable.ctx_->lock);
-        return stable.ctx_->entries.size();
+        size_t size = 0;
+        for (size_t i = 0; i < stable.ctx_->shardsCount(); ++i) {
+            auto& shard = stable.ctx_->shard(i);
+            ReadLock g(shard.lock, *stable.ctx_);
+            size += shard.entries.size();
+        }
+        return size;
     } RETHROW_WITH_PREFIX("effil.size");
 }
 
-SharedTable::PairsIterator SharedTable::globalLuaPairs(sol::this_state state, const sol::stack_object& obj) {
+sol::object SharedTable::luaGetMany(sol::this_state state, const sol::stack_object& tbl, const sol::stack_object& keys) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.get_many' (effil.table expected, got " << luaTypename(tbl) << ")";
+    REQUIRE(keys.valid() && keys.get_type() == sol::type::table)
+            << "bad argument #2 to 'effil.get_many' (table expected, got " << luaTypename(keys) << ")";
+    try {
+        return tbl.as<SharedTable>().getMany(keys, state);
+    } RETHROW_WITH_PREFIX("effil.get_many");
+}
+
+SharedTable SharedTable::luaSetMany(const sol::stack_object& tbl, const sol::stack_object& values) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.set_many' (effil.table expected, got " << luaTypename(tbl) << ")";
+    REQUIRE(values.valid() && values.get_type() == sol::type::table)
+            << "bad argument #2 to 'effil.set_many' (table expected, got " << luaTypename(values) << ")";
+    try {
+        auto& stable = tbl.as<SharedTable>();
+        stable.setMany(values);
+        return stable;
+    } RETHROW_WITH_PREFIX("effil.set_many");
+}
+
+void SharedTable::freezeTable(std::vector<SharedTable>& nested) {
+    UniqueLock metatableLock(ctx_->lock);
+    const auto locks = lockShards<UniqueLock>(*ctx_, allShards(*ctx_));
+    if (ctx_->frozen())
+        return;
+    ctx_->markFrozen();
+
+    const auto collect = [&](const StoredObject& object) {
+        const auto table = storedObjectTo<SharedTable>(object);
+        if (table && !table->ctx_->frozen())
+            nested.push_back(*table);
+    };
+    for (size_t i = 0; i < ctx_->shardsCount(); ++i) {
+        ctx_->shard(i).entries.forEach([&](const StoredObject* key, size_t, const StoredObject& value) {
+            if (key)
+                collect(*key);
+            collect(value);
+        });
+    }
+    if (ctx_->metatable != GCNull)
+        nested.push_back(GC::instance().get<SharedTable>(ctx_->metatable));
+}
+
+// Subtables are frozen one by one, so deep and recursive tables don't overflow the stack
+SharedTable SharedTable::luaFreeze(const sol::stack_object& tbl) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.freeze' (effil.table expected, got " << luaTypename(tbl) << ")";
+    auto& root = tbl.as<SharedTable>();
+    std::vector<SharedTable> pending = {root};
+    while (!pending.empty()) {
+        SharedTable table = pending.back();
+        pending.pop_back();
+        table.freezeTable(pending);
+    }
+    return root;
+}
+
+SharedTable::PairsIterator SharedTable::globalLuaPairs(sol::this_state state, const sol::stack_object& obj,
+                                                       const sol::stack_object& options) {
     REQUIRE(isSharedTable(obj)) << "bad argument #1 to 'effil.pairs' (effil.table expected, got " << luaTypename(obj) << ")";
+    REQUIRE(!options.valid() || options.get_type() == sol::type::table)
+            << "bad argument #2 to 'effil.pairs' (table expected, got " << luaTypename(options) << ")";
     auto& tbl = obj.as<SharedTable>();
+    if (options.valid() && options.as<sol::table>().get_or("snapshot", false))
+        return tbl.snapshotPairs(state);
     return tbl.luaPairs(state);
 }
 
@@ -415,6 +1113,101 @@ SharedTable::PairsIterator SharedTable::globalLuaNext(sol::this_state state, con
     return tbl.getNext(key, state);
 }
 
+/*
+ * Atomic operations
+ */
+
+sol::table SharedTable::exportAtomicAPI(sol::state_view& lua) {
+    sol::table api = lua.create_table_with();
+    api["add"] = [](sol::this_state state, const sol::stack_object& tbl, const sol::stack_object& key,
+                    const sol::stack_object& delta) {
+        REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.atomic.add' (effil.table expected, got "
+                                    << luaTypename(tbl) << ")";
+        REQUIRE(!delta.valid() || delta.get_type() == sol::type::number)
+                << "bad argument #3 to 'effil.atomic.add' (number expected, got " << luaTypename(delta) << ")";
+        try {
+            const StoredObject increment = delta.valid() ? createStoredObject(delta)
+                                                         : createStoredObject(static_cast<LUA_INDEX_TYPE>(1));
+            sol::object result = sol::nil;
+            tbl.as<SharedTable>().update(key, [&](const StoredObject* current, StoredObject& replacement) {
+                REQUIRE(current == nullptr || toNumber(*current))
+                        << "attempt to perform arithmetic on a " << luaTypename(current->unpack(state)) << " value";
+                replacement = current ? addNumbers(*current, increment) : increment;
+                result = replacement.unpack(state);
+                return true;
+            });
+            return result;
+        } RETHROW_WITH_PREFIX("effil.atomic.add");
+    };
+    api["exchange"] = [](sol::this_state state, const sol::stack_object& tbl, const sol::stack_object& key,
+                         const sol::stack_object& value) {
+        REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.atomic.exchange' (effil.table expected, got "
+                                    << luaTypename(tbl) << ")";
+        try {
+            StoredObject desired = storedValue(value);
+            sol::object previous = sol::nil;
+            tbl.as<SharedTable>().update(key, [&](const StoredObject* current, StoredObject& replacement) {
+                if (current)
+                    previous = current->unpack(state);
+                replacement = std::move(desired);
+                return current != nullptr || static_cast<bool>(replacement);
+            });
+            return previous;
+        } RETHROW_WITH_PREFIX("effil.atomic.exchange");
+    };
+    api["compare_and_swap"] = [](const sol::stack_object& tbl, const sol::stack_object& key,
+                                 const sol::stack_object& expected, const sol::stack_object& value) {
+        REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.atomic.compare_and_swap' (effil.table expected, got "
+                                    << luaTypename(tbl) << ")";
+        try {
+            const StoredObject expectedValue = expected.valid() ? createStoredObject(expected) : StoredObject::nil();
+            StoredObject desired = storedValue(value);
+            bool swapped = false;
+            tbl.as<SharedTable>().update(key, [&](const StoredObject* current, StoredObject& replacement) {
+                swapped = rawEqual(current, expectedValue);
+                if (!swapped)
+                    return false;
+                replacement = std::move(desired);
+                return current != nullptr || static_cast<bool>(replacement);
+            });
+            return swapped;
+        } RETHROW_WITH_PREFIX("effil.atomic.compare_and_swap");
+    };
+
+    // Bitwise operations return previous value, absent value is 0
+    const auto bitwise = [](const std::string& name, lua_Integer (*operation)(lua_Integer, lua_Integer)) {
+        return [name, operation](sol::this_state state, const sol::stack_object& tbl, const sol::stack_object& key,
+                                 const sol::stack_object& mask) {
+            REQUIRE(isSharedTable(tbl)) << "bad argument #1 to '" << name << "' (effil.table expected, got "
+                                        << luaTypename(tbl) << ")";
+            REQUIRE(mask.valid() && mask.get_type() == sol::type::number)
+                    << "bad argument #3 to '" << name << "' (number expected, got " << luaTypename(mask) << ")";
+            try {
+                const auto maskValue = toInteger(createStoredObject(mask));
+                REQUIRE(maskValue) << "number has no integer representation";
+                sol::object previous = sol::nil;
+                tbl.as<SharedTable>().update(key, [&](const StoredObject* current, StoredObject& replacement) {
+                    lua_Integer value = 0;
+                    if (current) {
+                        const auto integer = toInteger(*current);
+                        REQUIRE(integer) << (toNumber(*current) ? "number has no integer representation"
+                                                                : "attempt to perform bitwise operation on a "
+                                                                  + luaTypename(current->unpack(state)) + " value");
+                        value = *integer;
+                    }
+                    previous = sol::make_object(state, static_cast<LUA_INDEX_TYPE>(value));
+                    replacement = createStoredObject(static_cast<LUA_INDEX_TYPE>(operation(value, *maskValue)));
+                    return true;
+                });
+                return previous;
+            } RETHROW_WITH_PREFIX(name);
+        };
+    };
+    api["fetch_or"] = bitwise("effil.atomic.fetch_or", [](lua_Integer value, lua_Integer mask) { return value | mask; });
+    api["fetch_and"] = bitwise("effil.atomic.fetch_and", [](lua_Integer value, lua_Integer mask) { return value & mask; });
+    api["fetch_xor"] = bitwise("effil.atomic.fetch_xor", [](lua_Integer value, lua_Integer mask) { return value ^ mask; });
+    return api;
+}
 
 #undef DEFFINE_METAMETHOD_CALL_0
 #undef DEFFINE_METAMETHOD_CALL
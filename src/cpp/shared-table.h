@@ -2,26 +2,114 @@
 
 #include "gc-data.h"
 #include "stored-object.h"
-#include "spin-mutex.h"
+#include "stored-object-map.h"
+#include "shared-mutex.h"
 #include "utils.h"
 #include "lua-helpers.h"
 #include "gc-object.h"
 
 #include <sol.hpp>
 
-#include <map>
+#include <atomic>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace effil {
 
 
+// Metamethods which are looked up in metatables of shared tables
+enum class Metamethod : uint8_t {
+    Index, NewIndex, Call, Len, ToString, Pairs, IPairs, Unm, Eq,
+    Lt, Le, Add, Sub, Mul, Div, Mod, Pow, Concat
+};
+
 class SharedTableData : public GCData {
 public:
-    using DataEntries = std::map<StoredObject, StoredObject, StoredObjectLess>;
+    using DataEntries = StoredObjectMap;
+
+    // Entries are distributed between shards by hash of key,
+    // each shard is guarded by its own lock. Regular table has one shard.
+    struct Shard {
+        SharedMutex lock;
+        DataEntries entries;
+        // Count of modifications, it's changed under exclusive lock
+        std::atomic<uint64_t> version {0};
+    };
+
+    SharedTableData();
+
+    // Must be called before the table is shared
+    void split(size_t count);
+
+    size_t shardsCount() const { return shardsCount_; }
+    Shard& shard(size_t index) { return shards_[index]; }
+
+    // Key is StoredObject or StoredKeyView
+    template <typename Key>
+    size_t shardIndex(const Key& key) const {
+        return shardsCount_ == 1 ? 0 : key.hash() % shardsCount_;
+    }
+
+    template <typename Key>
+    Shard& shardOf(const Key& key) { return shards_[shardIndex(key)]; }
+
+    // Frozen table is never modified, so it's read without locks.
+    // Table is frozen under exclusive locks of all shards and metatable
+    bool frozen() const { return frozen_.load(std::memory_order_acquire); }
+    void markFrozen() { frozen_.store(true, std::memory_order_release); }
+
+    // Metamethods defined by the table when it's used as metatable.
+    // Bit of metamethod is updated on insertion and removal of its key under lock of the key's shard,
+    // so absent metamethods aren't looked up
+    bool defines(Metamethod method) const {
+        return (metamethods_.load(std::memory_order_acquire) & (1u << static_cast<unsigned>(method))) != 0;
+    }
+    void updateMetamethods(const StoredObject& key, bool defined);
+
+    // Version grows on each modification of entries or metatable.
+    // It's consistent when the table is locked (see SharedTable::luaDump)
+    uint64_t version() const;
+    uint64_t metatableVersion() const { return metatableVersion_.load(std::memory_order_relaxed); }
+    // Exclusive lock of the shard must be held
+    void modified(Shard& shard) { bump(shard.version); }
+    // Exclusive lock of metatable must be held
+    void metatableModified() { bump(metatableVersion_); }
+
 public:
-    SpinMutex lock;
-    DataEntries entries;
+    // Handles of deleted tables are reused, so tables are told apart by id
+    const uint64_t id;
+    SharedMutex lock; // guards metatable
     GCHandle metatable = GCNull;
+
+private:
+    Shard single_;
+    std::unique_ptr<Shard[]> split_;
+    Shard* shards_;
+    size_t shardsCount_;
+    std::atomic<bool> frozen_ {false};
+    std::atomic<uint32_t> metamethods_ {0};
+    std::atomic<uint64_t> metatableVersion_ {0};
+
+    // Counters have single writer, so increment doesn't need read-modify-write
+    static void bump(std::atomic<uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+};
+
+// Graph of tables converted by effil.dump.
+// Tables of the result are reused by the next dump while they and all tables reachable from them
+// keep versions recorded here
+struct DumpSnapshot {
+    struct Node {
+        uint64_t id;
+        uint64_t version;
+        // Tables referred by entries, metatable and upvalues of functions
+        std::vector<GCHandle> children;
+    };
+    std::unordered_map<GCHandle, Node> nodes;
 };
 
 class SharedTable : public GCObject<SharedTableData> {
@@ -30,13 +118,18 @@ private:
 
 public:
     static void exportAPI(sol::state_view& lua);
+    // Atomic operations on entries available in Lua as effil.atomic
+    static sol::table exportAtomicAPI(sol::state_view& lua);
 
     void set(StoredObject&&, StoredObject&&);
     void rawSet(const sol::stack_object& luaKey, const sol::stack_object& luaValue);
     sol::object get(const StoredObject& key, sol::this_state state) const;
+    sol::object get(const StoredKeyView& key, sol::this_state state) const;
+    sol::object getIndex(size_t index, sol::this_state state) const;
+    size_t length() const;
     sol::object rawGet(const sol::stack_object& key, sol::this_state state) const;
     static sol::object basicBinaryMetaMethod(
-            const std::string&, const std::string&, sol::this_state,
+            Metamethod, const std::string&, sol::this_state,
             const sol::stack_object&, const sol::stack_object&);
     SharedTable setMetatable(const sol::optional<SharedTable>& metaTable);
 
@@ -49,7 +142,10 @@ public:
     PairsIterator luaIPairs(sol::this_state);
     StoredArray luaCall(sol::this_state state, const sol::variadic_args& args);
     sol::object luaUnm(sol::this_state);
-    sol::object luaDump(sol::this_state state, BaseHolder::DumpCache& cache) const;
+    sol::object luaDump(sol::this_state state, StoredObject::DumpCache& cache) const;
+    // Unchanged tables are taken from previous result of dump.
+    // Previous may be nil for plain dump or true to start incremental dumps
+    sol::object luaDump(sol::this_state state, const sol::stack_object& previous) const;
 
     static sol::object luaAdd(sol::this_state, const sol::stack_object&, const sol::stack_object&);
     static sol::object luaSub(sol::this_state, const sol::stack_object&, const sol::stack_object&);
@@ -68,16 +164,48 @@ public:
     static sol::object luaRawGet(const sol::stack_object& tbl, const sol::stack_object& key, sol::this_state state);
     static SharedTable luaRawSet(const sol::stack_object& tbl, const sol::stack_object& key, const sol::stack_object& value);
     static size_t luaSize(const sol::stack_object& tbl);
-    static PairsIterator globalLuaPairs(sol::this_state state, const sol::stack_object& obj);
+    static sol::object luaGetMany(sol::this_state state, const sol::stack_object& tbl, const sol::stack_object& keys);
+    static SharedTable luaSetMany(const sol::stack_object& tbl, const sol::stack_object& values);
+    static SharedTable luaFreeze(const sol::stack_object& tbl);
+    static PairsIterator globalLuaPairs(sol::this_state state, const sol::stack_object& obj,
+                                        const sol::stack_object& options);
     static PairsIterator globalLuaIPairs(sol::this_state state, const sol::stack_object& obj);
     static PairsIterator globalLuaNext(sol::this_state state, const sol::stack_object& obj, const sol::stack_object& key);
 
 private:
-    PairsIterator getNext(const sol::object& key, sol::this_state lua) const;
+    PairsIterator getNext(const sol::stack_object& key, sol::this_state lua) const;
+    static PairsIterator luaPairsNext(sol::this_state lua, const SharedTable& table, const sol::stack_object& key);
+    PairsIterator snapshotPairs(sol::this_state lua) const;
+    // Freezes only this table, appends not frozen subtables and metatable to nested
+    void freezeTable(std::vector<SharedTable>& nested);
+    void setEntry(SharedTableData::Shard& shard, StoredObject&& key, StoredObject&& value);
+    void eraseEntry(SharedTableData::Shard& shard, const StoredObject& key);
+
+    // Replaces value of the key under exclusive lock of its shard.
+    // Func is called as func(const StoredObject* current, StoredObject& replacement),
+    // current is nullptr for absent key. Func returns false to keep the entry unchanged,
+    // absent replacement removes the entry
+    template <typename Func>
+    void update(const sol::stack_object& luaKey, const Func& func);
+    sol::object getMany(const sol::stack_object& keys, sol::this_state state) const;
+    void setMany(const sol::stack_object& values);
+    // Puts tables of previous dump which may be reused to the cache
+    std::vector<SharedTable> reuseDumped(const DumpSnapshot& previous, const sol::table& previousTables,
+                                         StoredObject::DumpCache& cache) const;
 
 private:
+    // Position of the key returned by the last getNext call of the view,
+    // so the next step of pairs doesn't look the key up
+    struct Cursor {
+        size_t shard = std::numeric_limits<size_t>::max(); // no position
+        size_t position = 0;
+    };
+    mutable Cursor cursor_;
+
     SharedTable() = default;
+    using GCObject<SharedTableData>::GCObject;
     void initialize() {}
+    void initialize(size_t shards) { ctx_->split(shards); }
     friend class GC;
 };
 
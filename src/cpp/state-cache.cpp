@@ -0,0 +1,294 @@
+#include "state-cache.h"
+
+#include "lua-helpers.h"
+#include "utils.h"
+
+#include <thread>
+
+namespace effil {
+
+namespace {
+
+// Registry keys of copies of tables and metatables of new state
+const std::string PRISTINE_TABLES = "effil.pristine_tables";
+const std::string PRISTINE_TYPE_METATABLES = "effil.pristine_type_metatables";
+
+// Types which metatable is shared by all values of the type (see debug.setmetatable)
+const int SHARED_METATABLE_TYPES[] = {
+    LUA_TNIL, LUA_TBOOLEAN, LUA_TLIGHTUSERDATA, LUA_TNUMBER, LUA_TSTRING, LUA_TFUNCTION, LUA_TTHREAD
+};
+
+int sampleFunction(lua_State*) { return 0; }
+
+void pushSample(lua_State* lua, int type) {
+    switch (type) {
+        case LUA_TBOOLEAN:       lua_pushboolean(lua, 0); break;
+        case LUA_TLIGHTUSERDATA: lua_pushlightuserdata(lua, nullptr); break;
+        case LUA_TNUMBER:        lua_pushnumber(lua, 0); break;
+        case LUA_TSTRING:        lua_pushstring(lua, ""); break;
+        case LUA_TFUNCTION:      lua_pushcfunction(lua, sampleFunction); break;
+        case LUA_TTHREAD:        lua_pushthread(lua); break;
+        default:                 lua_pushnil(lua); break;
+    }
+}
+
+sol::object metatableOf(lua_State* lua, int type) {
+    pushSample(lua, type);
+    if (!lua_getmetatable(lua, -1))
+        lua_pushnil(lua);
+    lua_remove(lua, -2);
+    return sol::stack::pop<sol::object>(lua);
+}
+
+void setMetatable(lua_State* lua, int type, const sol::object& metatable) {
+    pushSample(lua, type);
+    sol::stack::push(lua, metatable);
+    lua_setmetatable(lua, -2);
+    lua_pop(lua, 1);
+}
+
+sol::object metatableOf(const sol::table& table) {
+    lua_State* lua = table.lua_state();
+    sol::stack::push(lua, table);
+    if (!lua_getmetatable(lua, -1))
+        lua_pushnil(lua);
+    lua_remove(lua, -2);
+    return sol::stack::pop<sol::object>(lua);
+}
+
+void setMetatable(const sol::table& table, const sol::object& metatable) {
+    lua_State* lua = table.lua_state();
+    sol::stack::push(lua, table);
+    sol::stack::push(lua, metatable);
+    lua_setmetatable(lua, -2);
+    lua_pop(lua, 1);
+}
+
+// Copies entries and metatables of all tables reachable from global variables and
+// from metatables of primitive types: _G, standard libraries, package.loaded etc.
+// Result maps each table to { entries = <copy>, metatable = <metatable> }
+sol::table snapshotTables(sol::state_view& lua) {
+    std::vector<sol::table> pending;
+    lua_pushglobaltable(lua);
+    pending.push_back(sol::stack::pop<sol::table>(lua));
+    for (int type : SHARED_METATABLE_TYPES) {
+        const sol::object metatable = metatableOf(lua, type);
+        if (metatable.get_type() == sol::type::table)
+            pending.push_back(metatable.as<sol::table>());
+    }
+
+    sol::table snapshot = lua.create_table();
+    while (!pending.empty()) {
+        const sol::table table = pending.back();
+        pending.pop_back();
+        if (snapshot.raw_get<sol::object>(table).get_type() != sol::type::nil)
+            continue;
+
+        sol::table entries = lua.create_table();
+        for (const auto& entry : table) {
+            entries.raw_set(entry.first, entry.second);
+            if (entry.second.get_type() == sol::type::table)
+                pending.push_back(entry.second.as<sol::table>());
+        }
+        const sol::object metatable = metatableOf(table);
+        if (metatable.get_type() == sol::type::table)
+            pending.push_back(metatable.as<sol::table>());
+        snapshot.raw_set(table, lua.create_table_with("entries", entries, "metatable", metatable));
+    }
+    return snapshot;
+}
+
+// Removes all keys which are absent in pristine table
+// and brings back original values of the rest
+void restoreTable(sol::table target, const sol::table& pristine) {
+    std::vector<sol::object> added;
+    for (const auto& entry : target) {
+        if (pristine.raw_get<sol::object>(entry.first).get_type() == sol::type::nil)
+            added.push_back(entry.first);
+    }
+    for (const auto& key : added)
+        target.raw_set(key, sol::nil);
+    for (const auto& entry : pristine)
+        target.raw_set(entry.first, entry.second);
+}
+
+} // namespace
+
+LuaStateCache::LuaStateCache()
+        : capacity_(0)
+        , fillerStarted_(false)
+        , hits_(0)
+        , misses_(0)
+        , recycled_(0) {}
+
+LuaStateCache& LuaStateCache::instance() {
+    // Cache is never destroyed: background filler may outlive static objects
+    static LuaStateCache* cache = new LuaStateCache();
+    return *cache;
+}
+
+std::unique_ptr<sol::state> LuaStateCache::createState() {
+    auto lua = std::make_unique<sol::state>();
+    luaL_openlibs(*lua);
+    luaopen_effil(*lua);
+    sol::stack::pop<sol::object>(*lua);
+
+    // Remember initial tables and metatables to be able to reset state after usage
+    sol::state_view view(*lua);
+    sol::table typeMetatables = view.create_table();
+    for (int type : SHARED_METATABLE_TYPES)
+        typeMetatables.raw_set(type, metatableOf(view, type));
+
+    sol::table registry = view.registry();
+    registry[PRISTINE_TABLES] = snapshotTables(view);
+    registry[PRISTINE_TYPE_METATABLES] = typeMetatables;
+    return lua;
+}
+
+bool LuaStateCache::resetState(sol::state& lua, bool collectGarbage) {
+    try {
+        lua_sethook(lua, nullptr, 0, 0);
+        lua_settop(lua, 0);
+
+        sol::table registry = lua.registry();
+        const sol::table typeMetatables = registry[PRISTINE_TYPE_METATABLES];
+        for (int type : SHARED_METATABLE_TYPES)
+            setMetatable(lua, type, typeMetatables.raw_get<sol::object>(type));
+
+        const sol::table tables = registry[PRISTINE_TABLES];
+        for (const auto& entry : tables) {
+            const sol::table table = entry.first.as<sol::table>();
+            const sol::table pristine = entry.second.as<sol::table>();
+            restoreTable(table, pristine.raw_get<sol::table>("entries"));
+            setMetatable(table, pristine.raw_get<sol::object>("metatable"));
+        }
+
+        // Release effil objects referenced by previous owner
+        lua_gc(lua, LUA_GCRESTART, 0);
+        if (collectGarbage)
+            lua_gc(lua, LUA_GCCOLLECT, 0);
+        return true;
+    } catch (const std::exception& err) {
+        DEBUG("state_cache") << "Unable to reset state: " << err.what();
+        return false;
+    }
+}
+
+std::unique_ptr<sol::state> LuaStateCache::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!states_.empty()) {
+            auto lua = std::move(states_.back());
+            states_.pop_back();
+            ++hits_;
+            cv_.notify_one();
+            return lua;
+        }
+        ++misses_;
+    }
+    return createState();
+}
+
+void LuaStateCache::release(std::unique_ptr<sol::state> lua) {
+    if (!lua)
+        return;
+
+    bool hasRoom;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        hasRoom = states_.size() < capacity_;
+    }
+    if (!hasRoom || !resetState(*lua))
+        return;
+
+    std::lock_guard<std::mutex> lock(lock_);
+    if (states_.size() < capacity_) {
+        states_.push_back(std::move(lua));
+        ++recycled_;
+    }
+}
+
+void LuaStateCache::fill() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        cv_.wait(lock, [this](){ return states_.size() < capacity_; });
+        lock.unlock();
+
+        std::unique_ptr<sol::state> lua;
+        try {
+            lua = createState();
+        } catch (const std::exception& err) {
+            DEBUG("state_cache") << "Unable to create state: " << err.what();
+            lock.lock();
+            fillerStarted_ = false;
+            return;
+        }
+
+        lock.lock();
+        if (states_.size() < capacity_)
+            states_.push_back(std::move(lua));
+    }
+}
+
+size_t LuaStateCache::capacity() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return capacity_;
+}
+
+void LuaStateCache::capacity(size_t newCapacity) {
+    std::vector<std::unique_ptr<sol::state>> redundant;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        capacity_ = newCapacity;
+        while (states_.size() > capacity_) {
+            redundant.push_back(std::move(states_.back()));
+            states_.pop_back();
+        }
+
+        if (capacity_ > 0 && !fillerStarted_) {
+            fillerStarted_ = true;
+            std::thread(&LuaStateCache::fill, this).detach();
+        }
+        cv_.notify_one();
+    }
+}
+
+size_t LuaStateCache::count() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return states_.size();
+}
+
+sol::table LuaStateCache::exportAPI(sol::state_view& lua) {
+    sol::table api = lua.create_table_with();
+    api["capacity"] = [](const sol::stack_object& newCapacity) {
+        auto previous = instance().capacity();
+        if (newCapacity.valid()) {
+            REQUIRE(newCapacity.get_type() == sol::type::number)
+                    << "bad argument #1 to 'effil.state_cache.capacity' (number expected, got "
+                    << luaTypename(newCapacity) << ")";
+            REQUIRE(newCapacity.as<int>() >= 0)
+                    << "effil.state_cache.capacity: invalid capacity value = "
+                    << newCapacity.as<int>();
+            instance().capacity(newCapacity.as<size_t>());
+        }
+        return previous;
+    };
+    api["count"] = [] {
+        return instance().count();
+    };
+    api["stats"] = [](sol::this_state state) {
+        sol::state_view lua(state);
+        auto& cache = instance();
+        std::lock_guard<std::mutex> lock(cache.lock_);
+        return lua.create_table_with(
+            "count", cache.states_.size(),
+            "capacity", cache.capacity_,
+            "hits", cache.hits_,
+            "misses", cache.misses_,
+            "recycled", cache.recycled_
+        );
+    };
+    return api;
+}
+
+} // namespace effil
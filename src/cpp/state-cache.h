@@ -0,0 +1,51 @@
+#pragma once
+
+#include <sol.hpp>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace effil {
+
+// Cache of idle Lua states with loaded standard libraries and effil module.
+// States are prepared by background thread and recycled by finished threads.
+class LuaStateCache {
+public:
+    static LuaStateCache& instance();
+    static sol::table exportAPI(sol::state_view& lua);
+
+    // Returns initialized state, it's taken from cache if possible
+    std::unique_ptr<sol::state> acquire();
+    // Puts state back to cache if there is enough capacity, destroys it otherwise
+    void release(std::unique_ptr<sol::state> lua);
+
+    // Brings state created by cache back to its initial content (see README for details).
+    // Returns false if state can't be reused
+    static bool resetState(sol::state& lua, bool collectGarbage = true);
+
+private:
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::vector<std::unique_ptr<sol::state>> states_;
+    size_t capacity_;
+    bool fillerStarted_;
+    uint64_t hits_;
+    uint64_t misses_;
+    uint64_t recycled_;
+
+private:
+    LuaStateCache();
+    LuaStateCache(LuaStateCache&&) = delete;
+    LuaStateCache(const LuaStateCache&) = delete;
+
+    void fill();
+    size_t capacity();
+    void capacity(size_t newCapacity);
+    size_t count();
+
+    static std::unique_ptr<sol::state> createState();
+};
+
+} // namespace effil
@@ -0,0 +1,296 @@
+#include "stored-object-map.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace effil {
+
+namespace {
+
+constexpr size_t NOT_FOUND = std::numeric_limits<size_t>::max();
+constexpr size_t MIN_CAPACITY = 8;
+
+// Flag of iteration positions in hash part, others are positions in array part
+constexpr size_t HASH_POSITION = ~(std::numeric_limits<size_t>::max() >> 1);
+
+// Fibonacci hashing spreads poor hashes (e.g. integers) over the index
+constexpr uint64_t HASH_MULTIPLIER = 11400714819323198485ull;
+
+size_t capacityFor(size_t count) {
+    size_t capacity = MIN_CAPACITY;
+    while (capacity < count * 2)
+        capacity *= 2;
+    return capacity;
+}
+
+size_t log2(size_t value) {
+    size_t result = 0;
+    while (value >>= 1)
+        ++result;
+    return result;
+}
+
+} // namespace
+
+StoredObjectMap::StoredObjectMap()
+        : border_(0)
+        , hashIndices_(0)
+        , shift_(0)
+        , size_(0) {}
+
+size_t StoredObjectMap::slotOf(size_t hash) const {
+    return static_cast<size_t>((static_cast<uint64_t>(hash) * HASH_MULTIPLIER) >> shift_);
+}
+
+template <typename Key>
+size_t StoredObjectMap::findSlot(const Key& key) const {
+    if (slots_.empty())
+        return NOT_FOUND;
+
+    const size_t mask = slots_.size() - 1;
+    const uint32_t tag = static_cast<uint32_t>(key.hash());
+    for (size_t i = slotOf(key.hash()); ; i = (i + 1) & mask) {
+        const Slot& slot = slots_[i];
+        if (slot.entry == 0)
+            return NOT_FOUND;
+        if (slot.hashTag == tag && entries_[slot.entry - 1].key.equal(key))
+            return i;
+    }
+}
+
+template <typename Key>
+StoredObjectMap::Entry* StoredObjectMap::lookup(const Key& key) {
+    const size_t slot = findSlot(key);
+    return slot == NOT_FOUND ? nullptr : &entries_[slots_[slot].entry - 1];
+}
+
+template <typename Key>
+const StoredObjectMap::Entry* StoredObjectMap::lookup(const Key& key) const {
+    const size_t slot = findSlot(key);
+    return slot == NOT_FOUND ? nullptr : &entries_[slots_[slot].entry - 1];
+}
+
+StoredObject* StoredObjectMap::find(const StoredObject& key) {
+    return const_cast<StoredObject*>(findValue(key));
+}
+
+const StoredObject* StoredObjectMap::find(const StoredObject& key) const {
+    return findValue(key);
+}
+
+StoredObject* StoredObjectMap::find(const StoredKeyView& key) {
+    return const_cast<StoredObject*>(findValue(key));
+}
+
+const StoredObject* StoredObjectMap::find(const StoredKeyView& key) const {
+    return findValue(key);
+}
+
+template <typename Key>
+const StoredObject* StoredObjectMap::findValue(const Key& key) const {
+    if (const size_t index = key.arrayIndex()) {
+        if (index <= array_.size())
+            return array_[index - 1] ? &array_[index - 1] : nullptr;
+        if (hashIndices_ == 0)
+            return nullptr;
+    }
+    const Entry* entry = lookup(key);
+    return entry && entry->value ? &entry->value : nullptr;
+}
+
+const StoredObject* StoredObjectMap::findIndex(size_t index) const {
+    if (index >= 1 && index <= array_.size())
+        return array_[index - 1] ? &array_[index - 1] : nullptr;
+    if (hashIndices_ == 0)
+        return nullptr;
+    return findValue(StoredKeyView(static_cast<LUA_INDEX_TYPE>(index)));
+}
+
+void StoredObjectMap::insert(StoredObject&& key, StoredObject&& value) {
+    assert(value);
+    ++size_;
+
+    const size_t index = key.arrayIndex();
+    if (index != 0 && index <= array_.size()) {
+        // fill a hole
+        assert(!array_[index - 1]);
+        array_[index - 1] = std::move(value);
+        while (border_ < array_.size() && array_[border_])
+            ++border_;
+    } else if (index != 0 && index == array_.size() + 1) {
+        appendToArray(std::move(value));
+
+        // following keys are moved from hash part to keep it free of index array_.size() + 1
+        while (hashIndices_ > 0) {
+            Entry* entry = lookup(StoredKeyView(static_cast<LUA_INDEX_TYPE>(array_.size() + 1)));
+            if (entry == nullptr || !entry->value)
+                break;
+            --hashIndices_;
+            appendToArray(std::move(entry->value));
+        }
+    } else {
+        if (index != 0)
+            ++hashIndices_;
+        insertEntry(std::move(key), std::move(value));
+    }
+}
+
+void StoredObjectMap::appendToArray(StoredObject&& value) {
+    array_.push_back(std::move(value));
+    if (border_ + 1 == array_.size())
+        border_ = array_.size();
+}
+
+StoredObject StoredObjectMap::erase(const StoredObject& key) {
+    const size_t index = key.arrayIndex();
+    if (index != 0 && index <= array_.size()) {
+        StoredObject removed = std::move(array_[index - 1]);
+        if (!removed)
+            return StoredObject();
+        --size_;
+        border_ = std::min(border_, index - 1);
+        while (!array_.empty() && !array_.back())
+            array_.pop_back();
+        return removed;
+    }
+    if (index != 0 && hashIndices_ == 0)
+        return StoredObject();
+
+    Entry* entry = lookup(key);
+    if (entry == nullptr || !entry->value)
+        return StoredObject();
+    --size_;
+    if (index != 0)
+        --hashIndices_;
+    return std::move(entry->value);
+}
+
+bool StoredObjectMap::nextInArray(size_t from, Item& item) const {
+    for (size_t i = from; i < array_.size(); ++i) {
+        if (array_[i]) {
+            item = Item{nullptr, i + 1, &array_[i], i};
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StoredObjectMap::nextInHash(size_t from, Item& item) const {
+    for (size_t i = from; i < entries_.size(); ++i) {
+        if (entries_[i].value) {
+            item = Item{&entries_[i].key, 0, &entries_[i].value, HASH_POSITION | i};
+            return true;
+        }
+    }
+    return false;
+}
+
+bool StoredObjectMap::next(const StoredObject* key, Item& item) const {
+    return nextAfter(key, item);
+}
+
+bool StoredObjectMap::next(const StoredKeyView* key, Item& item) const {
+    return nextAfter(key, item);
+}
+
+template <typename Key>
+bool StoredObjectMap::nextAfter(const Key* key, Item& item) const {
+    const Entry* previous = nullptr;
+    if (key == nullptr) {
+        if (nextInArray(0, item))
+            return true;
+    } else {
+        const size_t index = key->arrayIndex();
+        if (index != 0 && index <= array_.size()) {
+            if (nextInArray(index, item))
+                return true;
+        } else {
+            previous = lookup(*key);
+            // removed index from the tail of array part
+            REQUIRE(previous != nullptr || index != 0) << "invalid key to 'next'";
+        }
+    }
+    return nextInHash(previous ? static_cast<size_t>(previous - entries_.data()) + 1 : 0, item);
+}
+
+bool StoredObjectMap::isAt(size_t position, const StoredObject& key) const {
+    return isAtPosition(position, key);
+}
+
+bool StoredObjectMap::isAt(size_t position, const StoredKeyView& key) const {
+    return isAtPosition(position, key);
+}
+
+// Removed entries keep their keys, so position is valid until the index is rebuilt
+template <typename Key>
+bool StoredObjectMap::isAtPosition(size_t position, const Key& key) const {
+    if (position & HASH_POSITION) {
+        const size_t entry = position & ~HASH_POSITION;
+        return entry < entries_.size() && entries_[entry].key.equal(key);
+    }
+    return key.arrayIndex() == position + 1;
+}
+
+bool StoredObjectMap::nextFrom(size_t position, Item& item) const {
+    if (position & HASH_POSITION)
+        return nextInHash((position & ~HASH_POSITION) + 1, item);
+    return nextInArray(position + 1, item) || nextInHash(0, item);
+}
+
+// Key must not be presented in hash part, removed entry of the key is reused.
+// Keys are interned, so tables with the same fields share their names
+void StoredObjectMap::insertEntry(StoredObject&& key, StoredObject&& value) {
+    key.intern();
+    if (Entry* removed = lookup(key)) {
+        assert(!removed->value);
+        removed->key = std::move(key);
+        removed->value = std::move(value);
+        return;
+    }
+
+    if ((entries_.size() + 1) * 2 > slots_.size())
+        rebuild();
+
+    const size_t mask = slots_.size() - 1;
+    const size_t hash = key.hash();
+    size_t i = slotOf(hash);
+    while (slots_[i].entry != 0)
+        i = (i + 1) & mask;
+
+    slots_[i].hashTag = static_cast<uint32_t>(hash);
+    entries_.push_back(Entry{std::move(key), std::move(value)});
+    slots_[i].entry = static_cast<uint32_t>(entries_.size());
+}
+
+// Drops removed entries and builds index with room for one more entry
+void StoredObjectMap::rebuild() {
+    const size_t alive = std::count_if(entries_.begin(), entries_.end(),
+                                       [](const Entry& entry) { return static_cast<bool>(entry.value); });
+    if (alive != entries_.size()) {
+        std::vector<Entry> compacted;
+        compacted.reserve(alive + 1);
+        for (Entry& entry : entries_)
+            if (entry.value)
+                compacted.push_back(std::move(entry));
+        entries_.swap(compacted);
+    }
+
+    const size_t capacity = capacityFor(entries_.size() + 1);
+
+    slots_.assign(capacity, Slot{0, 0});
+    shift_ = 64 - log2(capacity);
+
+    const size_t mask = capacity - 1;
+    for (size_t e = 0; e < entries_.size(); ++e) {
+        const size_t hash = entries_[e].key.hash();
+        size_t i = slotOf(hash);
+        while (slots_[i].entry != 0)
+            i = (i + 1) & mask;
+        slots_[i] = Slot{static_cast<uint32_t>(e + 1), static_cast<uint32_t>(hash)};
+    }
+}
+
+} // namespace effil
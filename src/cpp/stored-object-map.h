@@ -0,0 +1,117 @@
+#pragma once
+
+#include "stored-object.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace effil {
+
+// Storage of shared table entries.
+// Like in Lua table values of keys 1..n are kept in array part,
+// so length and access by index are O(1). Array part may contain holes (absent values),
+// its last element is always presented.
+// Other entries are kept in hash part in insertion order in contiguous array,
+// open addressing index refers to them (linear probing).
+// Removed entries keep their keys until the next rebuild of index,
+// so iteration can be continued from the removed key like in Lua.
+class StoredObjectMap {
+public:
+    struct Entry {
+        StoredObject key;
+        StoredObject value; // absent if entry is removed
+    };
+
+    // Result of iteration, key is nullptr for values of array part.
+    // Position allows to continue iteration without lookup of the key (see nextFrom)
+    struct Item {
+        const StoredObject* key;
+        size_t index;
+        const StoredObject* value;
+        size_t position;
+    };
+
+    StoredObjectMap();
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Number of sequential keys from 1 (see luaLength)
+    size_t length() const { return border_; }
+
+    // Returns value of the key or nullptr.
+    // Lookups by StoredKeyView or index don't allocate memory
+    StoredObject* find(const StoredObject& key);
+    const StoredObject* find(const StoredObject& key) const;
+    StoredObject* find(const StoredKeyView& key);
+    const StoredObject* find(const StoredKeyView& key) const;
+    const StoredObject* findIndex(size_t index) const;
+
+    // Key must not be presented in map
+    void insert(StoredObject&& key, StoredObject&& value);
+    // Returns removed value or absent object if key is absent
+    StoredObject erase(const StoredObject& key);
+
+    // Iteration over array part and then over hash part.
+    // Starts from the beginning if key is nullptr. Returns false at the end
+    bool next(const StoredObject* key, Item& item) const;
+    bool next(const StoredKeyView* key, Item& item) const;
+
+    // Checks that the key is still at position of item returned by next,
+    // then iteration is continued by nextFrom(position)
+    bool isAt(size_t position, const StoredObject& key) const;
+    bool isAt(size_t position, const StoredKeyView& key) const;
+    bool nextFrom(size_t position, Item& item) const;
+
+    // Func is called with (const StoredObject* key, size_t index, const StoredObject& value),
+    // key is nullptr for values of array part
+    template <typename Func>
+    void forEach(const Func& func) const {
+        for (size_t i = 0; i < array_.size(); ++i)
+            if (array_[i])
+                func(nullptr, i + 1, array_[i]);
+        for (const Entry& entry : entries_)
+            if (entry.value)
+                func(&entry.key, 0, entry.value);
+    }
+
+private:
+    struct Slot {
+        uint32_t entry;   // index in entries_ + 1, 0 for empty slot
+        uint32_t hashTag; // part of key hash to skip most of key comparisons
+    };
+
+    // Key is StoredObject or StoredKeyView
+    template <typename Key>
+    Entry* lookup(const Key& key);
+    template <typename Key>
+    const Entry* lookup(const Key& key) const;
+    template <typename Key>
+    size_t findSlot(const Key& key) const;
+    template <typename Key>
+    const StoredObject* findValue(const Key& key) const;
+    template <typename Key>
+    bool nextAfter(const Key* key, Item& item) const;
+    template <typename Key>
+    bool isAtPosition(size_t position, const Key& key) const;
+
+    size_t slotOf(size_t hash) const;
+    void insertEntry(StoredObject&& key, StoredObject&& value);
+    void rebuild();
+    void appendToArray(StoredObject&& value);
+    bool nextInArray(size_t from, Item& item) const;
+    bool nextInHash(size_t from, Item& item) const;
+
+private:
+    std::vector<StoredObject> array_;
+    size_t border_;
+
+    std::vector<Entry> entries_;
+    std::vector<Slot> slots_;
+    size_t hashIndices_; // number of array indices in hash part
+    size_t shift_;
+
+    size_t size_;
+};
+
+} // namespace effil
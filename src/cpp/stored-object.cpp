@@ -5,141 +5,367 @@
 #include "function.h"
 #include "utils.h"
 #include "thread-runner.h"
+#include "thread-pool.h"
+#include "array.h"
+#include "buffer.h"
+#include "string-pool.h"
 
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <limits>
 
 #include <cassert>
+#include <cstring>
 
 namespace effil {
 
+static_assert(sizeof(StoredObject) == 16, "StoredObject must stay compact");
+
 namespace {
 
-class ApiReferenceHolder : public BaseHolder {
-public:
-    bool rawCompare(const BaseHolder*) const noexcept final { return true; }
-    sol::object unpack(sol::this_state lua) const final {
-        luaopen_effil(lua);
-        return sol::stack::pop<sol::object>(lua);
+// FNV-1a, strings are hashed the same way whether they are stored or viewed from Lua stack
+size_t hashString(const char* data, size_t size) noexcept {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
     }
-};
-
-class NilHolder : public BaseHolder {
-public:
-    bool rawCompare(const BaseHolder*) const noexcept final { return true; }
-    sol::object unpack(sol::this_state) const final { return sol::nil; }
-};
+    return static_cast<size_t>(hash);
+}
 
-template <typename StoredType>
-class PrimitiveHolder : public BaseHolder {
-public:
-    PrimitiveHolder(const sol::stack_object& luaObject) noexcept
-            : data_(luaObject.as<StoredType>()) {}
+template <typename T>
+size_t hashOf(const T& value) noexcept { return std::hash<T>()(value); }
 
-    PrimitiveHolder(const sol::object& luaObject) noexcept
-            : data_(luaObject.as<StoredType>()) {}
+template <typename T>
+size_t toArrayIndex(const T&) { return 0; }
 
-    PrimitiveHolder(const StoredType& init) noexcept
-            : data_(init) {}
+size_t toArrayIndex(LUA_INDEX_TYPE value) {
+    if (value < 1 || value > static_cast<LUA_INDEX_TYPE>(std::numeric_limits<uint32_t>::max()))
+        return 0;
+    const size_t index = static_cast<size_t>(value);
+    // only integral values are indices in Lua 5.1 and 5.2
+    return static_cast<LUA_INDEX_TYPE>(index) == value ? index : 0;
+}
 
-    bool rawCompare(const BaseHolder* other) const noexcept final {
-        return data_ < static_cast<const PrimitiveHolder<StoredType>*>(other)->data_;
+StoredType gcTypeOf(const SharedTable&) { return StoredType::SharedTable; }
+StoredType gcTypeOf(const Channel&) { return StoredType::Channel; }
+StoredType gcTypeOf(const Function&) { return StoredType::Function; }
+StoredType gcTypeOf(const Thread&) { return StoredType::Thread; }
+StoredType gcTypeOf(const ThreadRunner&) { return StoredType::ThreadRunner; }
+StoredType gcTypeOf(const ThreadPool&) { return StoredType::ThreadPool; }
+StoredType gcTypeOf(const Array&) { return StoredType::Array; }
+StoredType gcTypeOf(const Buffer&) { return StoredType::Buffer; }
+
+// New view of GC object which is used as strong reference
+BaseGCObject* newView(StoredType type, GCHandle handle) {
+    switch (type) {
+        case StoredType::SharedTable:
+            return new SharedTable(GC::instance().get<SharedTable>(handle));
+        case StoredType::Channel:
+            return new Channel(GC::instance().get<Channel>(handle));
+        case StoredType::Function:
+            return new Function(GC::instance().get<Function>(handle));
+        case StoredType::Thread:
+            return new Thread(GC::instance().get<Thread>(handle));
+        case StoredType::ThreadRunner:
+            return new ThreadRunner(GC::instance().get<ThreadRunner>(handle));
+        case StoredType::ThreadPool:
+            return new ThreadPool(GC::instance().get<ThreadPool>(handle));
+        case StoredType::Array:
+            return new Array(GC::instance().get<Array>(handle));
+        case StoredType::Buffer:
+            return new Buffer(GC::instance().get<Buffer>(handle));
+        default:
+            assert(false);
+            return nullptr;
     }
+}
 
-    sol::object unpack(sol::this_state state) const final { return sol::make_object(state, data_); }
+} // namespace
 
-    StoredType getData() { return data_; }
+StoredObject::StoredObject(const StoredObject& other) {
+    copyFrom(other);
+}
 
-private:
-    StoredType data_;
-};
+StoredObject::StoredObject(StoredObject&& other) noexcept {
+    moveFrom(other);
+}
 
-template<typename T>
-class GCObjectHolder : public BaseHolder {
-public:
-    template <typename SolType>
-    GCObjectHolder(const SolType& luaObject) {
-        assert(luaObject.template is<T>());
-        strongRef_ = luaObject.template as<T>();
-        handle_ = strongRef_->handle();
+StoredObject& StoredObject::operator=(const StoredObject& other) {
+    if (this != &other) {
+        reset();
+        copyFrom(other);
     }
+    return *this;
+}
 
-    GCObjectHolder(GCHandle handle)
-            : handle_(handle) {
-        strongRef_ = GC::instance().get<T>(handle_);
+StoredObject& StoredObject::operator=(StoredObject&& other) noexcept {
+    if (this != &other) {
+        reset();
+        moveFrom(other);
     }
+    return *this;
+}
 
-    bool rawCompare(const BaseHolder* other) const final {
-        return handle_ < static_cast<const GCObjectHolder<T>*>(other)->handle_;
-    }
+void StoredObject::moveFrom(StoredObject& other) noexcept {
+    std::memcpy(payload_, other.payload_, INLINE_SIZE);
+    extra_ = other.extra_;
+    type_ = other.type_;
+    other.type_ = StoredType::None;
+    other.extra_ = 0;
+}
 
-    sol::object unpack(sol::this_state state) const override {
-        return sol::make_object(state, GC::instance().get<T>(handle_));
+void StoredObject::copyFrom(const StoredObject& other) {
+    std::memcpy(payload_, other.payload_, INLINE_SIZE);
+    extra_ = other.extra_;
+    // object stays absent until heap data is copied, so nothing leaks on exception
+    type_ = StoredType::None;
+    if (other.type_ == StoredType::String && other.extra_ == LONG_STRING) {
+        other.load<LongString*>()->acquire();
+    } else if (other.isGCObject() && other.extra_ == STRONG_REFERENCE) {
+        store(newView(other.type_, other.gcHandle()));
     }
+    type_ = other.type_;
+}
 
-    GCHandle gcHandle() const override { return handle_; }
+void StoredObject::reset() noexcept {
+    if (type_ == StoredType::String && extra_ == LONG_STRING)
+        load<LongString*>()->release();
+    else if (isGCObject() && extra_ == STRONG_REFERENCE)
+        delete load<BaseGCObject*>();
+    type_ = StoredType::None;
+    extra_ = 0;
+}
 
-    void releaseStrongReference() override {
-        strongRef_ = sol::nullopt;
-    }
+StoredObject StoredObject::nil() { return StoredObject(StoredType::Nil); }
 
-    void holdStrongReference() override {
-        if (!strongRef_) {
-            strongRef_ = GC::instance().get<T>(handle_);
-        }
+StoredObject StoredObject::apiReference() { return StoredObject(StoredType::ApiReference); }
+
+StoredObject StoredObject::fromBool(bool value) {
+    StoredObject result(StoredType::Boolean);
+    result.store(value);
+    return result;
+}
+
+StoredObject StoredObject::fromNumber(lua_Number value) {
+    StoredObject result(StoredType::Number);
+    result.store(value);
+    return result;
+}
+
+StoredObject StoredObject::fromInteger(lua_Integer value) {
+    StoredObject result(StoredType::Integer);
+    result.store(value);
+    return result;
+}
+
+StoredObject StoredObject::fromString(const char* data, size_t size) {
+    StoredObject result(StoredType::String);
+    if (size <= INLINE_SIZE) {
+        std::memcpy(result.payload_, data, size);
+        result.extra_ = static_cast<uint8_t>(size);
+    } else {
+        result.store(LongString::create(data, size, hashString(data, size)));
+        result.extra_ = LONG_STRING;
     }
+    return result;
+}
+
+StoredObject StoredObject::fromLightUserdata(void* value) {
+    StoredObject result(StoredType::LightUserdata);
+    result.store(value);
+    return result;
+}
+
+StoredObject StoredObject::fromCFunction(lua_CFunction value) {
+    StoredObject result(StoredType::CFunction);
+    result.store(value);
+    return result;
+}
 
-protected:
-    GCHandle handle_;
-    sol::optional<T> strongRef_;
-};
+template <typename T>
+StoredObject StoredObject::fromGCObject(const T& object) {
+    StoredObject result(StoredType::None);
+    result.store<BaseGCObject*>(new T(object));
+    result.extra_ = STRONG_REFERENCE;
+    result.type_ = gcTypeOf(object);
+    return result;
+}
 
-class SharedTableHolder : public GCObjectHolder<SharedTable> {
-public:
-    using GCObjectHolder<SharedTable>::GCObjectHolder;
+const char* StoredObject::stringData() const {
+    return extra_ == LONG_STRING ? load<LongString*>()->data : reinterpret_cast<const char*>(payload_);
+}
+
+size_t StoredObject::stringSize() const {
+    return extra_ == LONG_STRING ? load<LongString*>()->size : extra_;
+}
 
-    sol::object convertToLua(sol::this_state state, DumpCache& cache) const final {
-        return GC::instance().get<SharedTable>(handle_).luaDump(state, cache);
+size_t StoredObject::hash() const {
+    switch (type_) {
+        case StoredType::Boolean:
+            return hashOf(load<bool>());
+        case StoredType::Number:
+            return hashOf(load<lua_Number>());
+        case StoredType::Integer:
+            return hashOf(load<lua_Integer>());
+        case StoredType::String:
+            return extra_ == LONG_STRING ? load<LongString*>()->hash
+                                         : hashString(reinterpret_cast<const char*>(payload_), extra_);
+        case StoredType::LightUserdata:
+            return hashOf(load<void*>());
+        case StoredType::CFunction:
+            return hashOf(reinterpret_cast<uintptr_t>(load<lua_CFunction>()));
+        default:
+            return isGCObject() ? hashOf(gcHandle()) : 0;
     }
-};
+}
 
-class FunctionHolder : public GCObjectHolder<Function> {
-public:
-    template <typename SolType>
-    FunctionHolder(const SolType& luaObject) : GCObjectHolder<Function>(luaObject) {}
+size_t StoredObject::arrayIndex() const {
+    switch (type_) {
+        case StoredType::Number:
+            return toArrayIndex(load<lua_Number>());
+        case StoredType::Integer:
+            return toArrayIndex(load<lua_Integer>());
+        default:
+            return 0;
+    }
+}
 
-    sol::object unpack(sol::this_state state) const final {
-        return GC::instance().get<Function>(handle_).loadFunction(state);
+bool StoredObject::equal(const StoredObject& other) const {
+    if (type_ != other.type_)
+        return false;
+    switch (type_) {
+        case StoredType::None:
+        case StoredType::Nil:
+        case StoredType::ApiReference:
+            return true;
+        case StoredType::Boolean:
+            return load<bool>() == other.load<bool>();
+        case StoredType::Number:
+            return load<lua_Number>() == other.load<lua_Number>();
+        case StoredType::Integer:
+            return load<lua_Integer>() == other.load<lua_Integer>();
+        case StoredType::String:
+            if (extra_ == LONG_STRING && other.extra_ == LONG_STRING) {
+                const LongString* left = load<LongString*>();
+                const LongString* right = other.load<LongString*>();
+                if (left == right)
+                    return true;
+                // there is only one interned copy of any string
+                if (left->interned && right->interned)
+                    return false;
+            }
+            return stringSize() == other.stringSize()
+                   && std::memcmp(stringData(), other.stringData(), stringSize()) == 0;
+        case StoredType::LightUserdata:
+            return load<void*>() == other.load<void*>();
+        case StoredType::CFunction:
+            return load<lua_CFunction>() == other.load<lua_CFunction>();
+        default:
+            return gcHandle() == other.gcHandle();
     }
+}
 
-    sol::object convertToLua(sol::this_state state, DumpCache& cache) const final {
-        return GC::instance().get<Function>(handle_).convertToLua(state, cache);
+bool StoredObject::equal(const StoredKeyView& key) const {
+    if (type_ != key.type())
+        return false;
+    switch (type_) {
+        case StoredType::Boolean:
+            return load<bool>() == key.boolean();
+        case StoredType::Number:
+            return load<lua_Number>() == key.number();
+        case StoredType::Integer:
+            return load<lua_Integer>() == key.integer();
+        case StoredType::String:
+            return stringSize() == key.size() && std::memcmp(stringData(), key.data(), key.size()) == 0;
+        case StoredType::LightUserdata:
+            return load<void*>() == key.pointer();
+        default:
+            return isGCObject() && gcHandle() == key.pointer();
     }
-};
-
-class CFunctionHolder : public BaseHolder {
-public:
-    CFunctionHolder(sol::state_view state, int stack_index)
-        : BaseHolder()
-    {
-        cfunction_ = lua_tocfunction(state, stack_index);
-        REQUIRE(cfunction_ != nullptr) << "can't get C function pointer";
+}
+
+sol::object StoredObject::unpack(sol::this_state state) const {
+    switch (type_) {
+        case StoredType::Boolean:
+            return sol::make_object(state, load<bool>());
+        case StoredType::Number:
+            return sol::make_object(state, load<lua_Number>());
+        case StoredType::Integer:
+            return sol::make_object(state, load<lua_Integer>());
+        case StoredType::String:
+            lua_pushlstring(state, stringData(), stringSize());
+            return sol::stack::pop<sol::object>(state);
+        case StoredType::LightUserdata:
+            return sol::make_object(state, load<void*>());
+        case StoredType::CFunction:
+            lua_pushcfunction(state, load<lua_CFunction>());
+            return sol::stack::pop<sol::object>(state);
+        case StoredType::ApiReference:
+            luaopen_effil(state);
+            return sol::stack::pop<sol::object>(state);
+        case StoredType::SharedTable:
+            return sol::make_object(state, GC::instance().get<SharedTable>(gcHandle()));
+        case StoredType::Channel:
+            return sol::make_object(state, GC::instance().get<Channel>(gcHandle()));
+        case StoredType::Function:
+            return GC::instance().get<Function>(gcHandle()).loadFunction(state);
+        case StoredType::Thread:
+            return sol::make_object(state, GC::instance().get<Thread>(gcHandle()));
+        case StoredType::ThreadRunner:
+            return sol::make_object(state, GC::instance().get<ThreadRunner>(gcHandle()));
+        case StoredType::ThreadPool:
+            return sol::make_object(state, GC::instance().get<ThreadPool>(gcHandle()));
+        case StoredType::Array:
+            return sol::make_object(state, GC::instance().get<Array>(gcHandle()));
+        case StoredType::Buffer:
+            return sol::make_object(state, GC::instance().get<Buffer>(gcHandle()));
+        default:
+            return sol::nil;
     }
+}
+
+sol::object StoredObject::convertToLua(sol::this_state state, DumpCache& cache) const {
+    switch (type_) {
+        case StoredType::SharedTable:
+            return GC::instance().get<SharedTable>(gcHandle()).luaDump(state, cache);
+        case StoredType::Function:
+            return GC::instance().get<Function>(gcHandle()).convertToLua(state, cache);
+        default:
+            return unpack(state);
+    }
+}
+
+GCHandle StoredObject::gcHandle() const {
+    if (!isGCObject())
+        return GCNull;
+    return extra_ == STRONG_REFERENCE ? load<BaseGCObject*>()->handle() : load<GCHandle>();
+}
+
+void StoredObject::intern() {
+    if (type_ == StoredType::String && extra_ == LONG_STRING)
+        store(StringPool::instance().intern(load<LongString*>()));
+}
 
-    sol::object unpack(sol::this_state state) const final {
-        lua_pushcfunction(state, cfunction_);
-        return sol::stack::pop<sol::object>(state);
+void StoredObject::releaseStrongReference() {
+    if (isGCObject() && extra_ == STRONG_REFERENCE) {
+        BaseGCObject* view = load<BaseGCObject*>();
+        store(view->handle());
+        extra_ = 0;
+        delete view;
     }
+}
 
-    bool rawCompare(const BaseHolder* other) const override {
-        const auto cfh = dynamic_cast<const CFunctionHolder*>(other);
-        return cfh && cfh->cfunction_ == cfunction_;
+void StoredObject::holdStrongReference() {
+    if (isGCObject() && extra_ != STRONG_REFERENCE) {
+        store(newView(type_, load<GCHandle>()));
+        extra_ = STRONG_REFERENCE;
     }
+}
 
-private:
-    lua_CFunction cfunction_;
-};
+namespace {
 
 void dumpTable(SharedTable& target, const sol::table& luaTable, SolTableToShared& visited);
 
@@ -153,9 +379,9 @@ StoredObject makeStoredObject(const sol::object& luaObject, SolTableToShared& vi
             SharedTable table = GC::instance().create<SharedTable>();
             visited.push_back({luaTable, table.handle()});
             dumpTable(table, luaTable, visited);
-            return std::make_unique<SharedTableHolder>(table.handle());
+            return StoredObject::fromGCObject(table);
         } else {
-            return std::make_unique<SharedTableHolder>(st->second);
+            return StoredObject::fromGCObject(GC::instance().get<SharedTable>(st->second));
         }
     } else {
         return createStoredObject(luaObject, visited);
@@ -168,14 +394,28 @@ void dumpTable(SharedTable& target, const sol::table& luaTable, SolTableToShared
     }
 }
 
+void dumpTableWithMetatable(SharedTable& target, const sol::table& luaTable, SolTableToShared& visited) {
+    // Let's dump table and all subtables
+    // SolTableToShared is used to prevent from infinity recursion
+    // in recursive tables
+    dumpTable(target, luaTable, visited);
+
+    const sol::table luaMetatable = luaTable[sol::metatable_key];
+    if (luaMetatable.valid()) {
+        SharedTable metaTable = GC::instance().create<SharedTable>();
+        dumpTable(metaTable, luaMetatable, visited);
+        target.setMetatable(metaTable);
+    }
+}
+
 template <typename SolObject>
 StoredObject fromSolObject(const SolObject& luaObject, SolTableToShared& visited) {
     switch (luaObject.get_type()) {
         case sol::type::nil:
-            return std::make_unique<NilHolder>();
+            return StoredObject::nil();
             break;
         case sol::type::boolean:
-            return std::make_unique<PrimitiveHolder<bool>>(luaObject);
+            return StoredObject::fromBool(luaObject.template as<bool>());
         case sol::type::number:
         {
 #if LUA_VERSION_NUM == 503
@@ -183,38 +423,51 @@ StoredObject fromSolObject(const SolObject& luaObject, SolTableToShared& visited
             int isInterger = lua_isinteger(luaObject.lua_state(), -1);
             sol::stack::pop<sol::object>(luaObject.lua_state());
             if (isInterger)
-                return std::make_unique<PrimitiveHolder<lua_Integer>>(luaObject);
+                return StoredObject::fromInteger(luaObject.template as<lua_Integer>());
             else
 #endif // Lua5.3
-                return std::make_unique<PrimitiveHolder<lua_Number>>(luaObject);
+                return StoredObject::fromNumber(luaObject.template as<lua_Number>());
+        }
+        case sol::type::string: {
+            auto poper = sol::stack::push_pop(luaObject);
+            size_t size = 0;
+            const char* data = lua_tolstring(luaObject.lua_state(), -1, &size);
+            return StoredObject::fromString(data, size);
         }
-        case sol::type::string:
-            return std::make_unique<PrimitiveHolder<std::string>>(luaObject);
         case sol::type::lightuserdata:
-            return std::make_unique<PrimitiveHolder<void*>>(luaObject);
+            return StoredObject::fromLightUserdata(luaObject.template as<void*>());
         case sol::type::userdata:
             if (luaObject.template is<SharedTable>())
-                return std::make_unique<SharedTableHolder>(luaObject);
+                return StoredObject::fromGCObject(luaObject.template as<SharedTable>());
             else if (luaObject.template is<Channel>())
-                return std::make_unique<GCObjectHolder<Channel>>(luaObject);
+                return StoredObject::fromGCObject(luaObject.template as<Channel>());
             else if (luaObject.template is<Function>())
-                return std::make_unique<FunctionHolder>(luaObject);
+                return StoredObject::fromGCObject(luaObject.template as<Function>());
             else if (luaObject.template is<Thread>())
-                return std::make_unique<GCObjectHolder<Thread>>(luaObject);
+                return StoredObject::fromGCObject(luaObject.template as<Thread>());
             else if (luaObject.template is<EffilApiMarker>())
-                return std::make_unique<ApiReferenceHolder>();
+                return StoredObject::apiReference();
             else if (luaObject.template is<ThreadRunner>())
-                return std::make_unique<GCObjectHolder<ThreadRunner>>(luaObject);
+                return StoredObject::fromGCObject(luaObject.template as<ThreadRunner>());
+            else if (luaObject.template is<ThreadPool>())
+                return StoredObject::fromGCObject(luaObject.template as<ThreadPool>());
+            else if (luaObject.template is<Array>())
+                return StoredObject::fromGCObject(luaObject.template as<Array>());
+            else if (luaObject.template is<Buffer>())
+                return StoredObject::fromGCObject(luaObject.template as<Buffer>());
             else
                 throw Exception() << "Unable to store userdata object";
         case sol::type::function: {
             {
                 auto poper = sol::stack::push_pop(luaObject);
-                if (lua_iscfunction(luaObject.lua_state(), -1))
-                    return std::make_unique<CFunctionHolder>(luaObject.lua_state(), -1);
+                if (lua_iscfunction(luaObject.lua_state(), -1)) {
+                    const lua_CFunction cfunction = lua_tocfunction(luaObject.lua_state(), -1);
+                    REQUIRE(cfunction != nullptr) << "can't get C function pointer";
+                    return StoredObject::fromCFunction(cfunction);
+                }
             }
             Function func = GC::instance().create<Function>(luaObject, visited);
-            return std::make_unique<FunctionHolder>(func.handle());
+            return StoredObject::fromGCObject(func);
         }
         case sol::type::table: {
             sol::table luaTable = luaObject;
@@ -223,46 +476,139 @@ StoredObject fromSolObject(const SolObject& luaObject, SolTableToShared& visited
                 return pair.first == luaTable;
             });
             if (iter != visited.end()) {
-                return std::make_unique<SharedTableHolder>(iter->second);
+                return StoredObject::fromGCObject(GC::instance().get<SharedTable>(iter->second));
             }
             // Tables pool is used to store tables.
             // Right now not defiantly clear how ownership between states works.
             SharedTable table = GC::instance().create<SharedTable>();
             visited.push_back({luaTable, table.handle()});
+            dumpTableWithMetatable(table, luaTable, visited);
+            return StoredObject::fromGCObject(table);
+        }
+        default:
+            throw Exception() << "unable to store object of " << luaTypename(luaObject) << " type";
+    }
+    return StoredObject();
+}
 
-            // Let's dump table and all subtables
-            // SolTableToShared is used to prevent from infinity recursion
-            // in recursive tables
-            dumpTable(table, luaTable, visited);
+} // namespace
 
-            const sol::table luaMetatable = luaTable[sol::metatable_key];
-            if (luaMetatable.valid()) {
-                SharedTable metaTable = GC::instance().create<SharedTable>();
-                dumpTable(metaTable, luaMetatable, visited);
-                table.setMetatable(metaTable);
+StoredKeyView::StoredKeyView(const sol::stack_object& luaObject) {
+    lua_State* state = luaObject.lua_state();
+    const int index = luaObject.stack_index();
+    switch (luaObject.get_type()) {
+        case sol::type::boolean:
+            type_ = StoredType::Boolean;
+            value_.boolean = lua_toboolean(state, index) != 0;
+            hash_ = hashOf(value_.boolean);
+            break;
+        case sol::type::number:
+#if LUA_VERSION_NUM == 503
+            if (lua_isinteger(state, index)) {
+                setIndex(lua_tointeger(state, index));
+                break;
             }
-            return std::make_unique<SharedTableHolder>(table.handle());
+#endif // Lua5.3
+            setNumber(lua_tonumber(state, index));
+            break;
+        case sol::type::string: {
+            size_t size = 0;
+            const char* data = lua_tolstring(state, index, &size);
+            setString(data, size);
+            break;
         }
+        case sol::type::lightuserdata:
+            type_ = StoredType::LightUserdata;
+            value_.pointer = lua_touserdata(state, index);
+            hash_ = hashOf(value_.pointer);
+            break;
+        case sol::type::userdata:
+            if (luaObject.is<SharedTable>()) {
+                type_ = StoredType::SharedTable;
+                value_.pointer = luaObject.as<SharedTable>().handle();
+            } else if (luaObject.is<Channel>()) {
+                type_ = StoredType::Channel;
+                value_.pointer = luaObject.as<Channel>().handle();
+            } else if (luaObject.is<Function>()) {
+                type_ = StoredType::Function;
+                value_.pointer = luaObject.as<Function>().handle();
+            } else if (luaObject.is<Thread>()) {
+                type_ = StoredType::Thread;
+                value_.pointer = luaObject.as<Thread>().handle();
+            } else if (luaObject.is<ThreadRunner>()) {
+                type_ = StoredType::ThreadRunner;
+                value_.pointer = luaObject.as<ThreadRunner>().handle();
+            } else if (luaObject.is<ThreadPool>()) {
+                type_ = StoredType::ThreadPool;
+                value_.pointer = luaObject.as<ThreadPool>().handle();
+            } else if (luaObject.is<Array>()) {
+                type_ = StoredType::Array;
+                value_.pointer = luaObject.as<Array>().handle();
+            } else if (luaObject.is<Buffer>()) {
+                type_ = StoredType::Buffer;
+                value_.pointer = luaObject.as<Buffer>().handle();
+            } else {
+                break;
+            }
+            hash_ = hashOf(value_.pointer);
+            break;
         default:
-            throw Exception() << "unable to store object of " << luaTypename(luaObject) << " type";
+            // nil, functions and tables can't be viewed
+            break;
     }
-    return nullptr;
 }
 
-} // namespace
+StoredKeyView::StoredKeyView(const std::string& string) {
+    setString(string.data(), string.size());
+}
+
+StoredKeyView::StoredKeyView(const char* string) {
+    setString(string, std::strlen(string));
+}
 
-StoredObject createStoredObject(bool value) { return std::make_unique<PrimitiveHolder<bool>>(value); }
+StoredKeyView::StoredKeyView(LUA_INDEX_TYPE index) {
+    setIndex(index);
+}
 
-StoredObject createStoredObject(lua_Number value) { return std::make_unique<PrimitiveHolder<lua_Number>>(value); }
+#if LUA_VERSION_NUM == 503
+void StoredKeyView::setIndex(lua_Integer value) {
+    type_ = StoredType::Integer;
+    value_.integer = value;
+    hash_ = hashOf(value);
+    arrayIndex_ = toArrayIndex(value);
+}
+#else
+void StoredKeyView::setIndex(lua_Number value) {
+    setNumber(value);
+}
+#endif // Lua5.3
 
-StoredObject createStoredObject(lua_Integer value) { return std::make_unique<PrimitiveHolder<lua_Integer>>(value); }
+void StoredKeyView::setNumber(lua_Number value) {
+    type_ = StoredType::Number;
+    value_.number = value;
+    hash_ = hashOf(value);
+    arrayIndex_ = toArrayIndex(value);
+}
+
+void StoredKeyView::setString(const char* data, size_t size) {
+    type_ = StoredType::String;
+    data_ = data;
+    size_ = size;
+    hash_ = hashString(data, size);
+}
+
+StoredObject createStoredObject(bool value) { return StoredObject::fromBool(value); }
+
+StoredObject createStoredObject(lua_Number value) { return StoredObject::fromNumber(value); }
+
+StoredObject createStoredObject(lua_Integer value) { return StoredObject::fromInteger(value); }
 
 StoredObject createStoredObject(const std::string& value) {
-    return std::make_unique<PrimitiveHolder<std::string>>(value);
+    return StoredObject::fromString(value.data(), value.size());
 }
 
 StoredObject createStoredObject(const char* value) {
-    return std::make_unique<PrimitiveHolder<std::string>>(value);
+    return StoredObject::fromString(value, std::strlen(value));
 }
 
 StoredObject createStoredObject(const sol::object& object) {
@@ -283,36 +629,51 @@ StoredObject createStoredObject(const sol::stack_object& obj, SolTableToShared&
     return fromSolObject(obj, visited);
 }
 
-template <typename DataType>
-sol::optional<DataType> getPrimitiveHolderData(const StoredObject& sobj) {
-    auto ptr = dynamic_cast<PrimitiveHolder<DataType>*>(sobj.get());
-    if (ptr)
-        return ptr->getData();
-    return sol::optional<DataType>();
+void dumpLuaTable(SharedTable& target, const sol::table& luaTable) {
+    SolTableToShared visited = {{luaTable, target.handle()}};
+    dumpTableWithMetatable(target, luaTable, visited);
 }
 
-sol::optional<bool> storedObjectToBool(const StoredObject& sobj) { return getPrimitiveHolderData<bool>(sobj); }
+sol::optional<bool> storedObjectToBool(const StoredObject& sobj) {
+    if (sobj.type() == StoredType::Boolean)
+        return sobj.load<bool>();
+    return sol::nullopt;
+}
 
-sol::optional<double> storedObjectToDouble(const StoredObject& sobj) { return getPrimitiveHolderData<double>(sobj); }
+sol::optional<double> storedObjectToDouble(const StoredObject& sobj) {
+    if (sobj.type() == StoredType::Number)
+        return sobj.load<lua_Number>();
+    return sol::nullopt;
+}
 
-sol::optional<LUA_INDEX_TYPE> storedObjectToIndexType(const StoredObject& sobj) { return getPrimitiveHolderData<LUA_INDEX_TYPE>(sobj); }
+sol::optional<LUA_INDEX_TYPE> storedObjectToIndexType(const StoredObject& sobj) {
+#if LUA_VERSION_NUM == 503
+    if (sobj.type() == StoredType::Integer)
+#else
+    if (sobj.type() == StoredType::Number)
+#endif // Lua5.3
+        return sobj.load<LUA_INDEX_TYPE>();
+    return sol::nullopt;
+}
 
 sol::optional<std::string> storedObjectToString(const StoredObject& sobj) {
-    return getPrimitiveHolderData<std::string>(sobj);
+    if (sobj.type() == StoredType::String)
+        return std::string(sobj.stringData(), sobj.stringSize());
+    return sol::nullopt;
 }
 
 template<>
 sol::optional<SharedTable> storedObjectTo(const StoredObject& obj) {
-    if (const auto ptr = std::dynamic_pointer_cast<SharedTableHolder>(obj)) {
-        return GC::instance().get<SharedTable>(ptr->gcHandle());
+    if (obj.type() == StoredType::SharedTable) {
+        return GC::instance().get<SharedTable>(obj.gcHandle());
     }
     return sol::nullopt;
 }
 
 template<>
 sol::optional<Function> storedObjectTo(const StoredObject& obj) {
-    if (const auto ptr = std::dynamic_pointer_cast<FunctionHolder>(obj)) {
-        return GC::instance().get<Function>(ptr->gcHandle());
+    if (obj.type() == StoredType::Function) {
+        return GC::instance().get<Function>(obj.gcHandle());
     }
     return sol::nullopt;
 }
@@ -5,43 +5,181 @@
 
 #include <sol.hpp>
 
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
 namespace effil {
 
 struct EffilApiMarker{};
 
-// Represents an interface for lua type stored at C++ code
-class BaseHolder {
+class SharedTable;
+struct DumpSnapshot;
+
+// Type of value stored at C++ code
+enum class StoredType : uint8_t {
+    None, // absent value (e.g. removed entry of table)
+    Nil,
+    Boolean,
+    Number,
+    Integer,
+    String,
+    LightUserdata,
+    CFunction,
+    ApiReference,
+    // GC objects
+    SharedTable,
+    Channel,
+    Function,
+    Thread,
+    ThreadRunner,
+    ThreadPool,
+    Array,
+    Buffer
+};
+
+// Non-owning key which is used to look up tables without allocations.
+// Hash and type of view are the same as of object which would be stored for the key.
+class StoredKeyView {
 public:
-    BaseHolder() = default;
-    virtual ~BaseHolder() = default;
+    // View of value on Lua stack, it is valid while the value stays on the stack
+    explicit StoredKeyView(const sol::stack_object& luaObject);
+    // View of string which must outlive the view
+    explicit StoredKeyView(const std::string& string);
+    explicit StoredKeyView(const char* string);
+    explicit StoredKeyView(LUA_INDEX_TYPE index);
+
+    // Not every type of keys is supported, such keys have to be stored to be looked up
+    bool valid() const { return type_ != StoredType::None; }
+
+    StoredType type() const { return type_; }
+    size_t hash() const { return hash_; }
+    size_t arrayIndex() const { return arrayIndex_; }
+
+    bool boolean() const { return value_.boolean; }
+    lua_Number number() const { return value_.number; }
+    lua_Integer integer() const { return value_.integer; }
+    void* pointer() const { return value_.pointer; }
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
 
-    bool compare(const BaseHolder* other) const {
-        if (typeid(*this) == typeid(*other))
-            return rawCompare(other);
-        return typeid(*this).before(typeid(*other));
-    }
+private:
+    void setIndex(LUA_INDEX_TYPE value);
+    void setNumber(lua_Number value);
+    void setString(const char* data, size_t size);
+
+    StoredType type_ = StoredType::None;
+    size_t hash_ = 0;
+    size_t arrayIndex_ = 0;
+    union {
+        bool boolean;
+        lua_Number number;
+        lua_Integer integer;
+        void* pointer; // light userdata or GC handle
+    } value_;
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+struct LongString;
 
-    virtual bool rawCompare(const BaseHolder* other) const = 0;
-    virtual const std::type_info& type() { return typeid(*this); }
-    virtual sol::object unpack(sol::this_state state) const = 0;
-    virtual GCHandle gcHandle() const { return GCNull; }
-    virtual void releaseStrongReference() { }
-    virtual void holdStrongReference() { }
+// Compact representation of Lua value stored at C++ code, it takes 16 bytes.
+// Numbers, booleans, pointers and strings up to 14 bytes are kept inline.
+// Only long strings and strong references to GC objects live in heap,
+// long strings are immutable and shared by copies.
+// Default constructed object is absent (see StoredType::None).
+class StoredObject {
+public:
+    StoredObject() noexcept : extra_(0), type_(StoredType::None) {}
+    StoredObject(const StoredObject& other);
+    StoredObject(StoredObject&& other) noexcept;
+    StoredObject& operator=(const StoredObject& other);
+    StoredObject& operator=(StoredObject&& other) noexcept;
+    ~StoredObject() { reset(); }
+
+    static StoredObject nil();
+    static StoredObject apiReference();
+    static StoredObject fromBool(bool value);
+    static StoredObject fromNumber(lua_Number value);
+    static StoredObject fromInteger(lua_Integer value);
+    static StoredObject fromString(const char* data, size_t size);
+    static StoredObject fromLightUserdata(void* value);
+    static StoredObject fromCFunction(lua_CFunction value);
+    // Creates strong reference to GC object
+    template <typename T>
+    static StoredObject fromGCObject(const T& object);
+
+    explicit operator bool() const { return type_ != StoredType::None; }
+    StoredType type() const { return type_; }
+    bool isGCObject() const { return type_ >= StoredType::SharedTable; }
+
+    // Equal objects always have equal hashes
+    size_t hash() const;
+
+    // Positive integer key which fits to array part of table, otherwise 0
+    size_t arrayIndex() const;
+
+    bool equal(const StoredObject& other) const;
+    bool equal(const StoredKeyView& key) const;
+
+    sol::object unpack(sol::this_state state) const;
+
+    // Lua tables made by effil.dump for shared tables.
+    // Graph of dumped tables is recorded to the snapshot if it's set
+    struct DumpCache {
+        std::unordered_map<GCHandle, sol::table> tables;
+        DumpSnapshot* snapshot = nullptr;
+    };
+    sol::object convertToLua(sol::this_state state, DumpCache& cache) const;
+
+    GCHandle gcHandle() const;
+
+    // Type must be String
+    const char* stringData() const;
+    size_t stringSize() const;
+
+    // Replaces long string with its process-wide interned copy (see StringPool)
+    void intern();
+
+    // Stored GC object is kept alive by strong reference until it is referred by the container
+    void releaseStrongReference();
+    void holdStrongReference();
 
+private:
+    static constexpr size_t INLINE_SIZE = 14;
+    // extra_ of strings which don't fit inline
+    static constexpr uint8_t LONG_STRING = 0xff;
+    // extra_ of GC objects which hold strong reference
+    static constexpr uint8_t STRONG_REFERENCE = 1;
+
+    explicit StoredObject(StoredType type) noexcept : extra_(0), type_(type) {}
+
+    template <typename T>
+    T load() const noexcept {
+        T value;
+        std::memcpy(&value, payload_, sizeof(T));
+        return value;
+    }
 
-    using DumpCache = std::unordered_map<GCHandle, int>;
-    virtual sol::object convertToLua(sol::this_state state, DumpCache&) const {
-        return unpack(state);
+    template <typename T>
+    void store(const T& value) noexcept {
+        static_assert(sizeof(T) <= INLINE_SIZE, "value doesn't fit inline");
+        std::memcpy(payload_, &value, sizeof(T));
     }
 
-private:
-    BaseHolder(const BaseHolder&) = delete;
-};
+    void copyFrom(const StoredObject& other);
+    void moveFrom(StoredObject& other) noexcept;
+    void reset() noexcept;
 
-typedef std::shared_ptr<BaseHolder> StoredObject;
+    friend sol::optional<bool> storedObjectToBool(const StoredObject&);
+    friend sol::optional<double> storedObjectToDouble(const StoredObject&);
+    friend sol::optional<LUA_INDEX_TYPE> storedObjectToIndexType(const StoredObject&);
+    friend sol::optional<std::string> storedObjectToString(const StoredObject&);
 
-struct StoredObjectLess {
-    bool operator()(const StoredObject& lhs, const StoredObject& rhs) const { return lhs->compare(rhs.get()); }
+private:
+    alignas(8) unsigned char payload_[INLINE_SIZE];
+    uint8_t extra_; // length of inline string or flags
+    StoredType type_;
 };
 
 StoredObject createStoredObject(bool);
@@ -57,6 +195,9 @@ using SolTableToShared = std::vector<std::pair<sol::table, GCHandle>>;
 StoredObject createStoredObject(const sol::object& obj, SolTableToShared& visited);
 StoredObject createStoredObject(const sol::stack_object& obj, SolTableToShared& visited);
 
+// Copies entries and metatable of Lua table into new shared table
+void dumpLuaTable(SharedTable& target, const sol::table& luaTable);
+
 sol::optional<bool> storedObjectToBool(const StoredObject&);
 sol::optional<double> storedObjectToDouble(const StoredObject&);
 sol::optional<LUA_INDEX_TYPE> storedObjectToIndexType(const StoredObject&);
@@ -0,0 +1,93 @@
+#include "string-pool.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace effil {
+
+constexpr size_t StringPool::MAX_INTERNED_SIZE;
+constexpr size_t StringPool::SHARDS;
+constexpr size_t StringPool::MIN_PURGE_THRESHOLD;
+
+LongString::LongString(size_t hash, size_t size) noexcept
+        : references(1)
+        , interned(false)
+        , hash(hash)
+        , size(size) {}
+
+LongString* LongString::create(const char* data, size_t size, size_t hash) {
+    void* memory = ::operator new(sizeof(LongString) + size);
+    LongString* string = new (memory) LongString(hash, size);
+    std::memcpy(string->data, data, size);
+    return string;
+}
+
+void LongString::destroy(LongString* string) noexcept {
+    string->~LongString();
+    ::operator delete(string);
+}
+
+void LongString::release() noexcept {
+    if (references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        destroy(this);
+}
+
+StringPool& StringPool::instance() {
+    // Pool is never destroyed: detached threads may intern and release strings after exit
+    static StringPool* pool = new StringPool();
+    return *pool;
+}
+
+bool StringPool::Equal::operator()(const LongString* left, const LongString* right) const noexcept {
+    return left->size == right->size && std::memcmp(left->data, right->data, left->size) == 0;
+}
+
+LongString* StringPool::intern(LongString* string) {
+    if (string->interned.load(std::memory_order_relaxed) || string->size > MAX_INTERNED_SIZE)
+        return string;
+
+    Shard& shard = shards_[string->hash % SHARDS];
+    std::lock_guard<std::mutex> lock(shard.lock);
+
+    const auto iter = shard.strings.find(string);
+    if (iter != shard.strings.end()) {
+        LongString* interned = *iter;
+        interned->acquire();
+        string->release();
+        return interned;
+    }
+
+    if (shard.strings.size() >= shard.purgeThreshold)
+        purge(shard);
+
+    string->interned = true;
+    string->acquire(); // reference of the pool
+    shard.strings.insert(string);
+    return string;
+}
+
+// Nobody else can acquire string referred only by the pool, because it's found under shard lock
+void StringPool::purge(Shard& shard) {
+    for (auto iter = shard.strings.begin(); iter != shard.strings.end();) {
+        LongString* string = *iter;
+        if (string->references.load(std::memory_order_acquire) == 1) {
+            iter = shard.strings.erase(iter);
+            LongString::destroy(string);
+        } else {
+            ++iter;
+        }
+    }
+    shard.purgeThreshold = std::max(MIN_PURGE_THRESHOLD, shard.strings.size() * 2);
+}
+
+size_t StringPool::size() {
+    size_t result = 0;
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        result += shard.strings.size();
+    }
+    return result;
+}
+
+} // namespace effil
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+
+namespace effil {
+
+// Immutable string which doesn't fit inline into StoredObject.
+// Block is shared by all copies of stored object and freed with the last of them.
+struct LongString {
+    std::atomic<size_t> references;
+    std::atomic<bool> interned;
+    const size_t hash;
+    const size_t size;
+    char data[1];
+
+    // Returns string with one reference
+    static LongString* create(const char* data, size_t size, size_t hash);
+
+    void acquire() noexcept { references.fetch_add(1, std::memory_order_relaxed); }
+    void release() noexcept;
+
+private:
+    LongString(size_t hash, size_t size) noexcept;
+    static void destroy(LongString* string) noexcept;
+    friend class StringPool;
+};
+
+// Process-wide set of strings used as keys of shared tables.
+// Equal interned strings share one block, so they are compared by pointer.
+// Pool holds a reference of each string. Strings referred only by the pool are purged
+// when the pool grows twice since the last purge.
+class StringPool {
+public:
+    static StringPool& instance();
+
+    // Strings longer than that are not interned
+    static constexpr size_t MAX_INTERNED_SIZE = 256;
+
+    // Takes reference of the string and returns referenced interned string with the same data
+    LongString* intern(LongString* string);
+
+    // Number of interned strings
+    size_t size();
+
+private:
+    StringPool() = default;
+
+    static constexpr size_t SHARDS = 16;
+    static constexpr size_t MIN_PURGE_THRESHOLD = 1024;
+
+    struct Hash {
+        size_t operator()(const LongString* string) const noexcept { return string->hash; }
+    };
+
+    struct Equal {
+        bool operator()(const LongString* left, const LongString* right) const noexcept;
+    };
+
+    struct Shard {
+        Shard() : purgeThreshold(MIN_PURGE_THRESHOLD) {}
+
+        std::mutex lock;
+        std::unordered_set<LongString*, Hash, Equal> strings;
+        size_t purgeThreshold;
+    };
+
+    void purge(Shard& shard);
+
+    std::array<Shard, SHARDS> shards_;
+
+private:
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+};
+
+} // namespace effil
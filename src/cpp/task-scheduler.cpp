@@ -0,0 +1,118 @@
+#include "task-scheduler.h"
+
+#include <cassert>
+
+namespace effil {
+
+namespace {
+
+// Scheduler and worker index of current thread (if it's a worker)
+thread_local TaskScheduler* thisScheduler = nullptr;
+thread_local size_t thisWorker = 0;
+
+} // namespace
+
+TaskScheduler::TaskScheduler(size_t workers)
+        : sleeping_(0)
+        , stopped_(false) {
+    for (size_t i = 0; i < workers; ++i)
+        deques_.emplace_back(std::make_unique<WorkStealingDeque<Task>>());
+}
+
+TaskScheduler::~TaskScheduler() {
+    for (auto& deque : deques_) {
+        while (Task* task = deque->steal())
+            delete task;
+    }
+}
+
+void TaskScheduler::attach(size_t worker) {
+    assert(worker < deques_.size());
+    thisScheduler = this;
+    thisWorker = worker;
+}
+
+void TaskScheduler::push(std::unique_ptr<Task> task) {
+    if (thisScheduler == this) {
+        deques_[thisWorker]->push(task.release());
+    } else {
+        std::lock_guard<std::mutex> lock(injectionLock_);
+        injection_.emplace_back(std::move(task));
+    }
+    wakeUp();
+}
+
+void TaskScheduler::wakeUp() {
+    // pairs with fence in pop() to not to miss sleeping worker
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed) > 0) {
+        std::lock_guard<std::mutex> lock(sleepLock_);
+        sleepCv_.notify_one();
+    }
+}
+
+Task* TaskScheduler::findTask(size_t worker) {
+    if (Task* task = deques_[worker]->pop())
+        return task;
+
+    {
+        std::lock_guard<std::mutex> lock(injectionLock_);
+        if (!injection_.empty()) {
+            Task* task = injection_.front().release();
+            injection_.pop_front();
+            return task;
+        }
+    }
+
+    for (size_t i = 1; i < deques_.size(); ++i) {
+        const size_t victim = (worker + i) % deques_.size();
+        if (Task* task = deques_[victim]->steal())
+            return task;
+    }
+    return nullptr;
+}
+
+bool TaskScheduler::hasTasks() {
+    {
+        std::lock_guard<std::mutex> lock(injectionLock_);
+        if (!injection_.empty())
+            return true;
+    }
+    for (const auto& deque : deques_) {
+        if (!deque->empty())
+            return true;
+    }
+    return false;
+}
+
+std::unique_ptr<Task> TaskScheduler::pop(size_t worker, const std::function<void()>& onIdle) {
+    bool idle = false;
+    while (true) {
+        if (Task* task = findTask(worker))
+            return std::unique_ptr<Task>(task);
+
+        if (stopped_)
+            return nullptr;
+
+        if (!idle) {
+            idle = true;
+            onIdle();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepLock_);
+        sleeping_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!stopped_ && !hasTasks())
+            sleepCv_.wait(lock);
+        sleeping_.fetch_sub(1);
+    }
+}
+
+void TaskScheduler::stop() {
+    stopped_ = true;
+    std::lock_guard<std::mutex> lock(sleepLock_);
+    sleepCv_.notify_all();
+}
+
+} // namespace effil
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "thread.h"
+#include "function.h"
+#include "work-stealing-deque.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace effil {
+
+// Serialized function call which result is reported via thread handle
+struct Task {
+    Thread thread;
+    Function function;
+    StoredArray arguments;
+};
+
+// Distributes tasks between fixed number of workers.
+// Each worker has own lock-free deque, idle workers steal tasks from others.
+// Tasks pushed by worker go to its own deque,
+// tasks pushed by any other thread go to the shared injection queue.
+class TaskScheduler {
+public:
+    explicit TaskScheduler(size_t workers);
+    ~TaskScheduler();
+
+    // Binds calling thread to worker's deque
+    void attach(size_t worker);
+
+    void push(std::unique_ptr<Task> task);
+
+    // Blocks until task appearance.
+    // onIdle is invoked once before falling asleep.
+    // Returns nullptr if scheduler is stopped and there is no tasks left.
+    std::unique_ptr<Task> pop(size_t worker, const std::function<void()>& onIdle);
+
+    void stop();
+
+private:
+    Task* findTask(size_t worker);
+    bool hasTasks();
+    void wakeUp();
+
+private:
+    std::vector<std::unique_ptr<WorkStealingDeque<Task>>> deques_;
+
+    std::mutex injectionLock_;
+    std::deque<std::unique_ptr<Task>> injection_;
+
+    std::mutex sleepLock_;
+    std::condition_variable sleepCv_;
+    std::atomic<size_t> sleeping_;
+    std::atomic<bool> stopped_;
+
+private:
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+};
+
+} // namespace effil
@@ -3,6 +3,8 @@
 #include "thread-handle.h"
 #include "notifier.h"
 
+#include <chrono>
+
 namespace effil {
 namespace this_thread {
 
@@ -62,6 +64,12 @@ void sleep(const sol::stack_object& duration, const sol::stack_object& metric) {
     }
 }
 
+// Monotonic wall clock in seconds, unlike os.clock it doesn't count CPU time of other threads
+double clock() {
+    const auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double>(now).count();
+}
+
 int pcall(lua_State* L)
 {
     int status;
@@ -19,6 +19,7 @@ void cancellationPoint();
 std::string threadId();
 void yield();
 void sleep(const sol::stack_object& duration, const sol::stack_object& metric);
+double clock();
 int pcall(lua_State* L);
 
 } // namespace this_thread
@@ -1,5 +1,7 @@
 #include "thread-handle.h"
 
+#include "state-cache.h"
+
 namespace effil {
 
 // Thread specific pointer to current thread
@@ -9,10 +11,17 @@ static const sol::optional<std::chrono::milliseconds> NO_TIMEOUT;
 ThreadHandle::ThreadHandle()
         : status_(Status::Running)
         , command_(Command::Run)
+        , lastListenerId_(0)
         , currNotifier_(nullptr)
-        , lua_(std::make_unique<sol::state>())
-{
-    luaL_openlibs(*lua_);
+        , step_(0)
+{}
+
+void ThreadHandle::createLua() {
+    lua_ = LuaStateCache::instance().acquire();
+}
+
+void ThreadHandle::releaseLua() {
+    LuaStateCache::instance().release(std::move(lua_));
 }
 
 void ThreadHandle::putCommand(Command cmd) {
@@ -26,12 +35,36 @@ void ThreadHandle::putCommand(Command cmd) {
 }
 
 void ThreadHandle::changeStatus(Status stat) {
+    std::map<size_t, CompletionListener> listeners;
+    {
+        std::unique_lock<std::mutex> lock(stateLock_);
+        status_ = stat;
+        commandNotifier_.reset();
+        statusNotifier_.notify();
+        if (isFinishStatus(stat)) {
+            completionNotifier_.notify();
+            listeners.swap(completionListeners_);
+        }
+    }
+    for (const auto& listener : listeners)
+        listener.second();
+}
+
+size_t ThreadHandle::addCompletionListener(const CompletionListener& listener) {
+    {
+        std::unique_lock<std::mutex> lock(stateLock_);
+        if (!isFinishStatus(status_)) {
+            completionListeners_.emplace(++lastListenerId_, listener);
+            return lastListenerId_;
+        }
+    }
+    listener();
+    return 0;
+}
+
+void ThreadHandle::removeCompletionListener(size_t id) {
     std::unique_lock<std::mutex> lock(stateLock_);
-    status_ = stat;
-    commandNotifier_.reset();
-    statusNotifier_.notify();
-    if (isFinishStatus(stat))
-        completionNotifier_.notify();
+    completionListeners_.erase(id);
 }
 
 void ThreadHandle::performInterruptionPointImpl(const std::function<void(void)>& cancelClbk) {
@@ -75,7 +108,6 @@ ThreadHandle* ThreadHandle::getThis() {
 }
 
 void ThreadHandle::setThis(ThreadHandle* handle) {
-    assert(handle);
     thisThreadHandle = handle;
 }
 
@@ -6,6 +6,8 @@
 
 #include <sol.hpp>
 
+#include <map>
+
 namespace effil {
 
 class ThreadCancelException : public std::runtime_error
@@ -36,11 +38,19 @@ public:
         Pause
     };
 
+    using CompletionListener = std::function<void()>;
+
 public:
     ThreadHandle();
     Command command() const { return command_; }
     void putCommand(Command cmd);
     void changeStatus(Status stat);
+
+    // Listener is invoked by thread which finishes this one
+    // or immediately if thread is already finished.
+    // Returns id to remove listener, 0 means listener was already invoked.
+    size_t addCompletionListener(const CompletionListener& listener);
+    void removeCompletionListener(size_t id);
     void performInterruptionPoint(lua_State* L);
     void performInterruptionPointThrow();
 
@@ -84,10 +94,14 @@ public:
         return  *lua_;
     }
 
-    void destroyLua() { lua_.reset(); }
+    void createLua();
+    void releaseLua();
 
     Status status() const { return status_; }
 
+    // Number of instructions between interruption points, 0 means they are disabled
+    int step() const { return step_; }
+
     StoredArray& result() { return result_; }
 
     void setNotifier(IInterruptable* notifier) {
@@ -107,9 +121,12 @@ private:
     Notifier commandNotifier_;
     Notifier completionNotifier_;
     std::mutex stateLock_;
+    std::map<size_t, CompletionListener> completionListeners_;
+    size_t lastListenerId_;
     StoredArray result_;
     IInterruptable* currNotifier_;
     std::unique_ptr<sol::state> lua_;
+    int step_;
 
     void performInterruptionPointImpl(const std::function<void(void)>& cancelClbk);
 
@@ -0,0 +1,132 @@
+#include "thread-pool.h"
+
+#include "function.h"
+#include "state-cache.h"
+#include "task-scheduler.h"
+
+#include <thread>
+
+namespace effil {
+
+using Status = ThreadHandle::Status;
+using Command = ThreadHandle::Command;
+
+ThreadPoolData::~ThreadPoolData() {
+    // Workers are detached and own the scheduler,
+    // they will finish already submitted tasks and exit
+    if (scheduler_)
+        scheduler_->stop();
+}
+
+void ThreadPool::initialize(
+    const std::string& path,
+    const std::string& cpath,
+    int step,
+    size_t workers)
+{
+    ctx_->scheduler_ = std::make_shared<TaskScheduler>(workers);
+    ctx_->workers_ = workers;
+    ctx_->step_ = step;
+
+    const WorkerConfig config{path, cpath, step};
+    for (size_t i = 0; i < workers; ++i) {
+        std::unique_ptr<sol::state> lua;
+        try {
+            lua = LuaStateCache::instance().acquire();
+            Thread::initializeState(*lua, path, cpath, step);
+        } RETHROW_WITH_PREFIX("effil.pool");
+
+        std::thread thr(&ThreadPool::runWorker, ctx_->scheduler_, i, config, std::move(lua));
+        thr.detach();
+    }
+}
+
+void ThreadPool::runWorker(
+    std::shared_ptr<TaskScheduler> scheduler,
+    size_t worker,
+    WorkerConfig config,
+    std::unique_ptr<sol::state> lua)
+{
+    scheduler->attach(worker);
+    const auto collectGarbage = [&lua](){
+        // Release objects of finished tasks while there is nothing to do
+        if (lua)
+            lua_gc(*lua, LUA_GCCOLLECT, 0);
+    };
+
+    while (auto task = scheduler->pop(worker, collectGarbage)) {
+        auto& ctx = task->thread.ctx_;
+        if (ctx->command() == Command::Cancel) {
+            task->arguments.clear();
+            ctx->changeStatus(Status::Cancelled);
+            continue;
+        }
+
+        // State which couldn't be reset after previous task is replaced by a new one.
+        // Worker is detached, so the task fails if there is no state to run it
+        if (!lua) {
+            try {
+                lua = LuaStateCache::instance().acquire();
+                Thread::initializeState(*lua, config.path, config.cpath, config.step);
+            } catch (const std::exception& err) {
+                lua.reset();
+                DEBUG("pool") << "Unable to create worker state: " << err.what() << std::endl;
+                task->arguments.clear();
+                ctx->result() = {
+                    createStoredObject("failed"),
+                    createStoredObject(std::string("effil.pool: unable to create worker state: ") + err.what())
+                };
+                ctx->changeStatus(Status::Failed);
+                continue;
+            }
+        }
+
+        const Status status = task->thread.execute(*lua, task->function, task->arguments);
+        ctx->changeStatus(status);
+
+        // Tasks don't see globals, modules and hooks of previous ones.
+        // Garbage is collected when worker is idle, so it's skipped here
+        try {
+            if (LuaStateCache::resetState(*lua, false))
+                Thread::initializeState(*lua, config.path, config.cpath, config.step);
+            else
+                lua.reset();
+        } catch (const std::exception& err) {
+            DEBUG("pool") << "Unable to reset worker state: " << err.what() << std::endl;
+            lua.reset();
+        }
+    }
+    LuaStateCache::instance().release(std::move(lua));
+}
+
+sol::object ThreadPool::submit(sol::this_state lua, const sol::stack_object& func, const sol::variadic_args& args) {
+    REQUIRE(func.valid() && func.get_type() == sol::type::function)
+            << "bad argument #1 to 'effil.pool:submit' (function expected, got "
+            << luaTypename(func) << ")";
+
+    sol::optional<Function> function;
+    try {
+        function = GC::instance().create<Function>(func.as<sol::function>());
+    } RETHROW_WITH_PREFIX("effil.pool");
+
+    Thread thread = GC::instance().create<Thread>(ctx_->step_);
+    StoredArray arguments;
+    try {
+        arguments = thread.storeArguments(args);
+    } RETHROW_WITH_PREFIX("effil.pool");
+
+    // Tasks submitted by pool worker are put into its own queue
+    ctx_->scheduler_->push(std::unique_ptr<Task>(new Task{thread, function.value(), std::move(arguments)}));
+    return sol::make_object(lua, thread);
+}
+
+void ThreadPool::exportAPI(sol::state_view& lua) {
+    sol::usertype<ThreadPool> type("new", sol::no_constructor,
+        "submit", &ThreadPool::submit,
+        "size",   &ThreadPool::size
+    );
+    sol::stack::push(lua, type);
+    sol::stack::pop<sol::object>(lua);
+}
+
+} // namespace effil
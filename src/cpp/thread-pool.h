@@ -0,0 +1,55 @@
+#pragma once
+
+#include "thread.h"
+#include "gc-data.h"
+#include "gc-object.h"
+
+#include <sol.hpp>
+
+namespace effil {
+
+class TaskScheduler;
+
+class ThreadPoolData : public GCData {
+public:
+    ~ThreadPoolData();
+
+    std::shared_ptr<TaskScheduler> scheduler_;
+    size_t workers_;
+    int step_;
+};
+
+// Set of long-lived workers. Each worker owns persistent Lua state
+// and runs submitted functions one by one. Tasks are distributed by TaskScheduler.
+class ThreadPool : public GCObject<ThreadPoolData> {
+public:
+    static void exportAPI(sol::state_view& lua);
+
+    sol::object submit(sol::this_state lua, const sol::stack_object& func, const sol::variadic_args& args);
+    size_t size() const { return ctx_->workers_; }
+
+private:
+    ThreadPool() = default;
+    using GCObject<ThreadPoolData>::GCObject;
+    void initialize(
+        const std::string& path,
+        const std::string& cpath,
+        int step,
+        size_t workers);
+    friend class GC;
+
+private:
+    struct WorkerConfig {
+        std::string path;
+        std::string cpath;
+        int step;
+    };
+
+    static void runWorker(
+        std::shared_ptr<TaskScheduler> scheduler,
+        size_t worker,
+        WorkerConfig config,
+        std::unique_ptr<sol::state> lua);
+};
+
+} // namespace effil
@@ -15,13 +15,13 @@ void ThreadRunner::initialize(
         ctx_->function_ = createStoredObject(func);
     } RETHROW_WITH_PREFIX("effil.thread");
 
-    ctx_->addReference(ctx_->function_->gcHandle());
-    ctx_->function_->releaseStrongReference();
+    ctx_->addReference(ctx_->function_.gcHandle());
+    ctx_->function_.releaseStrongReference();
 }
 
 sol::object ThreadRunner::call(sol::this_state lua, const sol::variadic_args& args) {
     return sol::make_object(lua, GC::instance().create<Thread>(
-        ctx_->path_, ctx_->cpath_, ctx_->step_, ctx_->function_->unpack(lua), args));
+        ctx_->path_, ctx_->cpath_, ctx_->step_, ctx_->function_.unpack(lua), args));
 }
 
 void ThreadRunner::exportAPI(sol::state_view& lua) {
@@ -26,6 +26,7 @@ struct ThreadRunner: public GCObject<ThreadRunnerData> {
 
 private:
     ThreadRunner() = default;
+    using GCObject<ThreadRunnerData>::GCObject;
     void initialize(
         const std::string& path,
         const std::string& cpath,
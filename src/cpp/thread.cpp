@@ -3,7 +3,6 @@
 #include "thread-handle.h"
 #include "stored-object.h"
 #include "notifier.h"
-#include "spin-mutex.h"
 #include "utils.h"
 
 #include <thread>
@@ -48,69 +47,178 @@ void luaHook(lua_State* L, lua_Debug*) {
     }
 }
 
+std::vector<Thread> toThreadsList(const sol::stack_object& obj, const std::string& funcName) {
+    REQUIRE(obj.valid() && obj.get_type() == sol::type::table)
+            << "bad argument #1 to '" << funcName << "' (table expected, got "
+            << luaTypename(obj) << ")";
+
+    sol::table tbl = obj;
+    std::vector<Thread> threads;
+    for (size_t i = 1; i <= tbl.size(); ++i) {
+        const sol::object thread = tbl[i];
+        REQUIRE(thread.is<Thread>())
+                << "bad argument #1 to '" << funcName << "' (effil.thread expected at index "
+                << i << ", got " << luaTypename(thread) << ")";
+        threads.push_back(thread.as<Thread>());
+    }
+    return threads;
+}
+
 } // namespace
 
-void Thread::runThread(
-    Thread thread,
-    Function function,
-    effil::StoredArray arguments)
-{
-    ThreadHandle::setThis(thread.ctx_.get());
+Status Thread::execute(sol::state& lua, const Function& function, StoredArray& arguments) {
+    ThreadHandle::setThis(ctx_.get());
+    ScopeGuard resetThis([](){
+        ThreadHandle::setThis(nullptr);
+    });
+
     try {
-        {
-            ScopeGuard reportComplete([thread, &arguments](){
-                // Let's destroy accociated state
-                // to release all resources as soon as possible
-                arguments.clear();
-                thread.ctx_->destroyLua();
-            });
-            sol::protected_function userFuncObj = function.loadFunction(thread.ctx_->lua());
+        ScopeGuard releaseArguments([&arguments](){
+            arguments.clear();
+        });
+        sol::protected_function userFuncObj = function.loadFunction(lua);
 
-            #if LUA_VERSION_NUM > 501
+        #if LUA_VERSION_NUM > 501
 
-            sol::stack::push(thread.ctx_->lua(), luaErrorHandlerPtr);
-            userFuncObj.error_handler = sol::reference(thread.ctx_->lua());
-            sol::stack::pop_n(thread.ctx_->lua(), 1);
+        sol::stack::push(lua, luaErrorHandlerPtr);
+        userFuncObj.error_handler = sol::reference(lua);
+        sol::stack::pop_n(lua, 1);
 
-            #endif // LUA_VERSION NUM > 501
+        #endif // LUA_VERSION NUM > 501
 
-            sol::protected_function_result result = userFuncObj(std::move(arguments));
-            if (!result.valid()) {
-                if (thread.ctx_->status() == Status::Cancelled)
-                    return;
+        sol::protected_function_result result = userFuncObj(std::move(arguments));
+        if (!result.valid()) {
+            if (ctx_->status() == Status::Cancelled)
+                return Status::Cancelled;
 
-                sol::error err = result;
-                std::string what = err.what();
-                throw std::runtime_error(what);
-            }
+            sol::error err = result;
+            std::string what = err.what();
+            throw std::runtime_error(what);
+        }
 
-            sol::variadic_args args(thread.ctx_->lua(), -lua_gettop(thread.ctx_->lua()));
-            for (const auto& iter : args) {
-                StoredObject store = createStoredObject(iter.get<sol::object>());
-                if (store->gcHandle() != nullptr)
-                {
-                    thread.ctx_->addReference(store->gcHandle());
-                    store->releaseStrongReference();
-                }
-                thread.ctx_->result().emplace_back(std::move(store));
+        sol::variadic_args args(lua, -lua_gettop(lua));
+        for (const auto& iter : args) {
+            StoredObject store = createStoredObject(iter.get<sol::object>());
+            if (store.gcHandle() != nullptr)
+            {
+                ctx_->addReference(store.gcHandle());
+                store.releaseStrongReference();
             }
+            ctx_->result().emplace_back(std::move(store));
         }
-        thread.ctx_->changeStatus(Status::Completed);
+        return Status::Completed;
     } catch (const std::exception& err) {
-        if (thread.ctx_->command() == Command::Cancel && strcmp(err.what(), ThreadCancelException::message) == 0) {
-            thread.ctx_->changeStatus(Status::Cancelled);
+        if (ctx_->command() == Command::Cancel && strcmp(err.what(), ThreadCancelException::message) == 0) {
+            return Status::Cancelled;
         } else {
             DEBUG("thread") << "Failed with msg: " << err.what() << std::endl;
-            auto& returns = thread.ctx_->result();
+            auto& returns = ctx_->result();
             returns.insert(returns.begin(), {
                 createStoredObject("failed"),
                 createStoredObject(err.what())
             });
-            thread.ctx_->changeStatus(Status::Failed);
+            return Status::Failed;
         }
     }
 }
 
+void Thread::runThread(
+    Thread thread,
+    Function function,
+    effil::StoredArray arguments)
+{
+    const Status status = thread.execute(thread.ctx_->lua(), function, arguments);
+
+    // Let's give accociated state back to cache (or destroy it)
+    // to release all resources as soon as possible
+    thread.ctx_->releaseLua();
+    thread.ctx_->changeStatus(status);
+}
+
+void Thread::initializeState(
+    sol::state& lua,
+    const std::string& path,
+    const std::string& cpath,
+    int step)
+{
+    lua["package"]["path"] = path;
+    lua["package"]["cpath"] = cpath;
+    if (step != 0)
+        lua_sethook(lua, luaHook, LUA_MASKCOUNT, step);
+}
+
+StoredArray Thread::storeArguments(const sol::variadic_args& variadicArgs) {
+    StoredArray arguments;
+    for (const auto& arg : variadicArgs) {
+        auto storedObj = createStoredObject(arg.get<sol::object>());
+        ctx_->addReference(storedObj.gcHandle());
+        storedObj.releaseStrongReference();
+        arguments.emplace_back(std::move(storedObj));
+    }
+    return arguments;
+}
+
+void Thread::startContinuation(
+    ThreadHandle& previous,
+    const Function& function,
+    const std::string& path,
+    const std::string& cpath)
+{
+    StoredArray arguments;
+    for (const auto& obj : previous.result()) {
+        ctx_->addReference(obj.gcHandle());
+        arguments.push_back(obj);
+    }
+
+    if (previous.status() != Status::Completed) {
+        // failure or cancellation is propagated to continuation
+        ctx_->result() = std::move(arguments);
+        ctx_->changeStatus(previous.status());
+        return;
+    }
+
+    // Lua state is prepared by the new thread, so the finishing one
+    // and other completion listeners don't wait for it
+    try {
+        std::thread thr(&Thread::runContinuation,
+                        *this,
+                        function,
+                        std::move(arguments),
+                        path,
+                        cpath);
+        thr.detach();
+    } catch (const std::exception& err) {
+        DEBUG("thread") << "Unable to start continuation: " << err.what() << std::endl;
+        ctx_->result() = {
+            createStoredObject("failed"),
+            createStoredObject(err.what())
+        };
+        ctx_->changeStatus(Status::Failed);
+    }
+}
+
+void Thread::runContinuation(
+    Thread thread,
+    Function function,
+    StoredArray arguments,
+    std::string path,
+    std::string cpath)
+{
+    try {
+        thread.ctx_->createLua();
+        initializeState(thread.ctx_->lua(), path, cpath, thread.ctx_->step());
+    } catch (const std::exception& err) {
+        DEBUG("thread") << "Unable to start continuation: " << err.what() << std::endl;
+        thread.ctx_->result() = {
+            createStoredObject("failed"),
+            createStoredObject(err.what())
+        };
+        thread.ctx_->changeStatus(Status::Failed);
+        return;
+    }
+    runThread(thread, function, std::move(arguments));
+}
+
 void Thread::initialize(
     const std::string& path,
     const std::string& cpath,
@@ -118,30 +226,21 @@ void Thread::initialize(
     const sol::function& function,
     const sol::variadic_args& variadicArgs)
 {
+    ctx_->step_ = step;
 
     sol::optional<Function> functionObj;
     try {
         functionObj = GC::instance().create<Function>(function);
     } RETHROW_WITH_PREFIX("effil.thread");
 
-    ctx_->lua()["package"]["path"] = path;
-    ctx_->lua()["package"]["cpath"] = cpath;
     try {
-        luaopen_effil(ctx_->lua());
-        sol::stack::pop<sol::object>(ctx_->lua());
+        ctx_->createLua();
     } RETHROW_WITH_PREFIX("effil.thread");
-
-    if (step != 0)
-        lua_sethook(ctx_->lua(), luaHook, LUA_MASKCOUNT, step);
+    initializeState(ctx_->lua(), path, cpath, step);
 
     effil::StoredArray arguments;
     try {
-        for (const auto& arg : variadicArgs) {
-            const auto& storedObj = createStoredObject(arg.get<sol::object>());
-            ctx_->addReference(storedObj->gcHandle());
-            storedObj->releaseStrongReference();
-            arguments.emplace_back(storedObj);
-        }
+        arguments = storeArguments(variadicArgs);
     } RETHROW_WITH_PREFIX("effil.thread");
 
     std::thread thr(&Thread::runThread,
@@ -159,7 +258,8 @@ void Thread::exportAPI(sol::state_view& lua) {
             "cancel", &Thread::cancel,
             "pause", &Thread::pause,
             "resume", &Thread::resume,
-            "status", &Thread::status);
+            "status", &Thread::status,
+            "and_then", &Thread::andThen);
 
     sol::stack::push(lua, type);
     sol::stack::pop<sol::object>(lua);
@@ -220,4 +320,76 @@ void Thread::resume() {
     ctx_->putCommand(Command::Run);
 }
 
+Thread Thread::andThen(sol::this_state state, const sol::stack_object& func) {
+    REQUIRE(func.valid() && func.get_type() == sol::type::function)
+            << "bad argument #1 to 'effil.thread:and_then' (function expected, got "
+            << luaTypename(func) << ")";
+
+    sol::optional<Function> function;
+    try {
+        function = GC::instance().create<Function>(func.as<sol::function>());
+    } RETHROW_WITH_PREFIX("effil.thread");
+
+    sol::state_view lua(state);
+    const std::string path = lua["package"]["path"];
+    const std::string cpath = lua["package"]["cpath"];
+
+    // continuation is interrupted as often as this thread
+    Thread continuation = GC::instance().create<Thread>(ctx_->step());
+    ThreadHandle* previous = ctx_.get();
+    ctx_->addCompletionListener([=]() mutable {
+        // listener is invoked while previous handle is alive
+        continuation.startContinuation(*previous, function.value(), path, cpath);
+    });
+    return continuation;
+}
+
+bool Thread::waitForCompletion(const std::vector<Thread>& threads, size_t required,
+                               const sol::optional<std::chrono::milliseconds>& time) {
+    if (required == 0)
+        return true;
+
+    // All threads share one notifier, which is triggered by the last required completion
+    const auto notifier = std::make_shared<Notifier>();
+    const auto left = std::make_shared<std::atomic<size_t>>(required);
+
+    std::vector<size_t> listeners;
+    ScopeGuard removeListeners([&threads, &listeners](){
+        for (size_t i = 0; i < listeners.size(); ++i)
+            threads[i].ctx_->removeCompletionListener(listeners[i]);
+    });
+    for (const auto& thread : threads) {
+        listeners.push_back(thread.ctx_->addCompletionListener([notifier, left]() {
+            if (left->fetch_sub(1) == 1)
+                notifier->notify();
+        }));
+    }
+
+    if (time)
+        return notifier->waitFor(*time);
+    notifier->wait();
+    return true;
+}
+
+sol::object Thread::luaWaitAny(sol::this_state state,
+                               const sol::stack_object& threadsObj,
+                               const sol::optional<int>& duration,
+                               const sol::optional<std::string>& period) {
+    const auto threads = toThreadsList(threadsObj, "effil.wait_any");
+    if (!threads.empty() && waitForCompletion(threads, 1, toOptionalTime(duration, period))) {
+        for (size_t i = 0; i < threads.size(); ++i) {
+            if (ThreadHandle::isFinishStatus(threads[i].ctx_->status()))
+                return sol::make_object(state, i + 1);
+        }
+    }
+    return sol::nil;
+}
+
+bool Thread::luaWaitAll(const sol::stack_object& threadsObj,
+                        const sol::optional<int>& duration,
+                        const sol::optional<std::string>& period) {
+    const auto threads = toThreadsList(threadsObj, "effil.wait_all");
+    return waitForCompletion(threads, threads.size(), toOptionalTime(duration, period));
+}
+
 } // effil
@@ -25,19 +25,47 @@ public:
                const sol::optional<int>& duration,
                const sol::optional<std::string>& period);
     void resume();
+    Thread andThen(sol::this_state state, const sol::stack_object& func);
+
+    static sol::object luaWaitAny(sol::this_state state,
+                                  const sol::stack_object& threads,
+                                  const sol::optional<int>& duration,
+                                  const sol::optional<std::string>& period);
+    static bool luaWaitAll(const sol::stack_object& threads,
+                           const sol::optional<int>& duration,
+                           const sol::optional<std::string>& period);
 
 private:
     Thread() = default;
+    using GCObject<ThreadHandle>::GCObject;
     void initialize(
         const std::string& path,
         const std::string& cpath,
         int step,
         const sol::function& function,
         const sol::variadic_args& args);
+    // Thread without own state, it's going to be run by pool worker or started as continuation
+    void initialize(int step) { ctx_->step_ = step; }
     friend class GC;
+    friend class ThreadPool;
 
 private:
+    static void initializeState(
+        sol::state& lua,
+        const std::string& path,
+        const std::string& cpath,
+        int step);
     static void runThread(Thread, Function, effil::StoredArray);
+
+    static bool waitForCompletion(const std::vector<Thread>& threads, size_t required,
+                                  const sol::optional<std::chrono::milliseconds>& time);
+
+    StoredArray storeArguments(const sol::variadic_args& args);
+    void startContinuation(ThreadHandle& previous, const Function& function,
+                           const std::string& path, const std::string& cpath);
+    static void runContinuation(Thread thread, Function function, StoredArray arguments,
+                                std::string path, std::string cpath);
+    ThreadHandle::Status execute(sol::state& lua, const Function& function, StoredArray& arguments);
 };
 
 } // effil
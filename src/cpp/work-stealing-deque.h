@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace effil {
+
+// Lock-free Chase-Lev deque of pointers.
+// Only owner thread is allowed to push and pop (from the bottom),
+// any other thread can steal elements (from the top).
+// Based on "Correct and Efficient Work-Stealing for Weak Memory Models"
+// by N.M. Le, A. Pop, A. Cohen and F. Zappa Nardelli.
+template <typename T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 64)
+            : top_(0)
+            , bottom_(0)
+            , buffer_(new Buffer(capacity)) {
+        buffers_.emplace_back(buffer_.load(std::memory_order_relaxed));
+    }
+
+    // Owner only
+    void push(T* item) {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        const int64_t top = top_.load(std::memory_order_acquire);
+        Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+        if (bottom - top > static_cast<int64_t>(buffer->capacity) - 1)
+            buffer = grow(buffer, bottom, top);
+
+        buffer->put(bottom, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only
+    T* pop() {
+        const int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+
+        T* item = nullptr;
+        if (top <= bottom) {
+            item = buffer->get(bottom);
+            if (top == bottom) {
+                // the last element, race with thieves
+                if (!top_.compare_exchange_strong(top, top + 1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = nullptr;
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+            }
+        } else {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread. Returns nullptr if deque is empty or race is lost.
+    T* steal() {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t bottom = bottom_.load(std::memory_order_acquire);
+
+        if (top < bottom) {
+            Buffer* buffer = buffer_.load(std::memory_order_acquire);
+            T* item = buffer->get(top);
+            if (top_.compare_exchange_strong(top, top + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed))
+                return item;
+        }
+        return nullptr;
+    }
+
+    bool empty() const {
+        const int64_t top = top_.load(std::memory_order_acquire);
+        const int64_t bottom = bottom_.load(std::memory_order_acquire);
+        return bottom <= top;
+    }
+
+private:
+    struct Buffer {
+        explicit Buffer(size_t size)
+                : capacity(size)
+                , items(new std::atomic<T*>[size]) {}
+
+        T* get(int64_t index) const {
+            return items[static_cast<size_t>(index) & (capacity - 1)].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t index, T* item) {
+            items[static_cast<size_t>(index) & (capacity - 1)].store(item, std::memory_order_relaxed);
+        }
+
+        const size_t capacity; // always power of 2
+        std::unique_ptr<std::atomic<T*>[]> items;
+    };
+
+    Buffer* grow(Buffer* buffer, int64_t bottom, int64_t top) {
+        Buffer* newBuffer = new Buffer(buffer->capacity * 2);
+        for (int64_t i = top; i < bottom; ++i)
+            newBuffer->put(i, buffer->get(i));
+
+        // Thieves may still read previous buffer,
+        // so it's kept until deque destruction
+        buffers_.emplace_back(newBuffer);
+        buffer_.store(newBuffer, std::memory_order_release);
+        return newBuffer;
+    }
+
+private:
+    std::atomic<int64_t> top_;
+    std::atomic<int64_t> bottom_;
+    std::atomic<Buffer*> buffer_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+
+private:
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+};
+
+} // namespace effil
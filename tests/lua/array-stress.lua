@@ -0,0 +1,59 @@
+require "bootstrap-tests"
+
+local effil = effil
+
+test.array_stress.tear_down = default_tear_down
+
+-- Reductions over large array compared with the same loops over plain Lua table
+test.array_stress.reductions = function()
+    local count = 10000000
+    local lua_data = {}
+    for i = 1, count do
+        lua_data[i] = i % 1000 / 8
+    end
+    local arr = effil.array("f64", count)
+    for i = 1, count do
+        arr[i] = lua_data[i]
+    end
+
+    local start = os.clock()
+    local lua_sum, lua_dot = 0, 0
+    for i = 1, count do
+        local v = lua_data[i]
+        lua_sum = lua_sum + v
+        lua_dot = lua_dot + v * v
+    end
+    local lua_time = os.clock() - start
+
+    start = os.clock()
+    local sum, dot = arr:sum(), arr:dot(arr)
+    local array_time = os.clock() - start
+
+    -- all values are multiples of 1/8, so sums are exact in any order
+    test.equal(sum, lua_sum)
+    test.equal(dot, lua_dot)
+
+    print(string.format("%d f64 elements: lua loop sum+dot %.3fs, effil.array sum+dot %.3fs",
+        count, lua_time, array_time))
+end
+
+-- Elements of array are passed to threads by reference
+test.array_stress.parallel_fill = function()
+    local count = 10000000
+    local workers = 4
+    local arr = effil.array("f32", count)
+    local chunk = count / workers
+
+    local threads = {}
+    for w = 1, workers do
+        threads[w] = effil.thread(function(data, first, last)
+            for i = first, last do
+                data[i] = 1
+            end
+        end)(arr, (w - 1) * chunk + 1, w * chunk)
+    end
+    for _, thr in ipairs(threads) do
+        test.equal(thr:wait(), "completed")
+    end
+    test.equal(arr:sum(), count)
+end
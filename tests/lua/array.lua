@@ -0,0 +1,159 @@
+require "bootstrap-tests"
+
+test.array.tear_down = default_tear_down
+
+-- to_table results are compared element by element, because test.equal compares tables by reference
+local function test_sequence(actual, expected)
+    test.equal(#actual, #expected)
+    for i = 1, #expected do
+        test.equal(actual[i], expected[i])
+    end
+end
+
+test.array.create = function()
+    for _, element_type in ipairs({"f64", "i64", "f32", "u8"}) do
+        local arr = effil.array(element_type, 10)
+        test.equal(effil.type(arr), "effil.array")
+        test.equal(arr:type(), element_type)
+        test.equal(#arr, 10)
+        test.equal(effil.size(arr), 10)
+        for i = 1, #arr do
+            test.equal(arr[i], 0)
+        end
+    end
+
+    test.equal(#effil.array("f64", 0), 0)
+    test.is_false(pcall(effil.array, "f16", 1))
+    test.is_false(pcall(effil.array, "f64", -1))
+    test.is_false(pcall(effil.array, "f64", 1.5))
+    test.is_false(pcall(effil.array, "u8", 2^64))
+    test.is_false(pcall(effil.array, "f64", math.huge))
+
+    local ok, err = pcall(effil.array, "f64", 2^50)
+    test.is_false(ok)
+    test.is_not_nil(string.find(err, "effil.array: unable to allocate", 1, true))
+end
+
+test.array.indexing = function()
+    local arr = effil.array("f64", 3)
+    arr[1] = 1.5
+    arr[3] = -2
+    test.equal(arr[1], 1.5)
+    test.equal(arr[2], 0)
+    test.equal(arr[3], -2)
+
+    test.is_false(pcall(function() return arr[0] end))
+    test.is_false(pcall(function() return arr[4] end))
+    test.is_false(pcall(function() arr[4] = 1 end))
+    test.is_false(pcall(function() arr[1] = "1" end))
+    test.is_false(pcall(function() arr.key = 1 end))
+    test.is_nil(arr.key)
+end
+
+test.array.integer_elements = function()
+    local bytes = effil.array("u8", 2)
+    bytes[1] = 255
+    test.equal(bytes[1], 255)
+    test.is_false(pcall(function() bytes[1] = 256 end))
+    test.is_false(pcall(function() bytes[1] = -1 end))
+    test.is_false(pcall(function() bytes[1] = 0.5 end))
+
+    local integers = effil.array("i64", 2)
+    integers[1] = -2^53
+    test.equal(integers[1], -2^53)
+    test.is_false(pcall(function() integers[1] = 2^63 end))
+    test.is_false(pcall(function() integers[1] = 1.5 end))
+
+    local floats = effil.array("f32", 1)
+    floats[1] = 0.1
+    test.not_equal(floats[1], 0.1) -- precision is lost
+    test.is_true(math.abs(floats[1] - 0.1) < 1e-6)
+end
+
+test.array.bulk_operations = function()
+    local arr = effil.array("i64", 5)
+    test.equal(arr:fill(7), arr)
+    test_sequence(arr:to_table(), {7, 7, 7, 7, 7})
+
+    arr:assign({1, 2, 3})
+    test_sequence(arr:to_table(), {1, 2, 3, 7, 7})
+    arr:assign({4, 5}, 4)
+    test_sequence(arr:to_table(), {1, 2, 3, 4, 5})
+    test_sequence(arr:to_table(2, 4), {2, 3, 4})
+    test_sequence(arr:to_table(4, 2), {})
+
+    -- nothing is copied if some value is wrong
+    test.is_false(pcall(arr.assign, arr, {9, "str"}))
+    test.is_false(pcall(arr.assign, arr, {9, 9}, 5))
+    test_sequence(arr:to_table(), {1, 2, 3, 4, 5})
+
+    local copy = effil.array("i64", 7)
+    copy:assign(arr, 2)
+    test_sequence(copy:to_table(), {0, 1, 2, 3, 4, 5, 0})
+    test.is_false(pcall(copy.assign, copy, effil.array("f64", 1)))
+end
+
+test.array.reductions = function()
+    local count = 1001 -- isn't a multiple of vector width
+    local numbers = effil.array("f64", count)
+    local bytes = effil.array("u8", count)
+    local expected_sum, expected_dot = 0, 0
+    for i = 1, count do
+        numbers[i] = i - 500.5
+        bytes[i] = i % 256
+        expected_sum = expected_sum + i % 256
+        expected_dot = expected_dot + (i % 256) ^ 2
+    end
+
+    test.equal(numbers:sum(), 500.5)
+    test.equal(numbers:min(), -499.5)
+    test.equal(numbers:max(), 500.5)
+    test.equal(bytes:sum(), expected_sum)
+    test.equal(bytes:min(), 0)
+    test.equal(bytes:max(), 255)
+    test.equal(bytes:dot(bytes), expected_dot)
+
+    local ones = effil.array("f64", count):fill(1)
+    test.equal(numbers:dot(ones), numbers:sum())
+    test.is_false(pcall(numbers.dot, numbers, bytes))
+    test.is_false(pcall(numbers.dot, numbers, effil.array("f64", 1)))
+
+    local empty = effil.array("f32", 0)
+    test.equal(empty:sum(), 0)
+    test.is_nil(empty:min())
+    test.is_nil(empty:max())
+end
+
+test.array.shared_by_reference = function()
+    local arr = effil.array("f64", 100)
+    local tbl = effil.table{ data = arr }
+    local chan = effil.channel()
+    chan:push(arr)
+
+    effil.thread(function(data)
+        data:fill(2)
+    end)(tbl.data):wait()
+
+    test.equal(arr:sum(), 200)
+    test.equal(chan:pop()[1], 2)
+    test.equal(tbl.data, arr)
+    test.equal(tbl.data, tbl.data)
+    test.not_equal(arr, effil.array("f64", 100))
+    test.not_equal(arr, tbl)
+end
+
+test.array.concurrent_writes = function()
+    local arr = effil.array("i64", 8)
+    local threads = {}
+    for t = 1, 4 do
+        threads[t] = effil.thread(function(data, index)
+            for i = 1, 1000 do
+                data[index] = data[index] + 1
+            end
+        end)(arr, t)
+    end
+    for _, thr in ipairs(threads) do
+        thr:wait()
+    end
+    test_sequence(arr:to_table(1, 4), {1000, 1000, 1000, 1000})
+end
@@ -0,0 +1,46 @@
+require "bootstrap-tests"
+
+local effil = effil
+
+test.buffer_stress.tear_down = default_tear_down
+
+-- Large payload passed through a chain of threads as string and as buffer
+test.buffer_stress.channel_hops = function()
+    local size = 10 * 1024 * 1024
+    local hops = 4
+    local messages = 20
+    local payload = string.rep("x", size)
+
+    local function measure(message)
+        local channels = {}
+        for i = 1, hops + 1 do
+            channels[i] = effil.channel()
+        end
+        local threads = {}
+        for i = 1, hops do
+            threads[i] = effil.thread(function(input, output, count)
+                for _ = 1, count do
+                    output:push(input:pop())
+                end
+            end)(channels[i], channels[i + 1], messages)
+        end
+
+        local start = os.clock()
+        for _ = 1, messages do
+            channels[1]:push(message)
+        end
+        for _ = 1, messages do
+            test.equal(#channels[hops + 1]:pop(), size)
+        end
+        for _, thr in ipairs(threads) do
+            test.equal(thr:wait(), "completed")
+        end
+        return os.clock() - start
+    end
+
+    local string_time = measure(payload)
+    local buffer_time = measure(effil.buffer(payload):seal())
+
+    print(string.format("%d messages of %d bytes through %d threads: string %.3fs, effil.buffer %.3fs",
+        messages, size, hops, string_time, buffer_time))
+end
@@ -0,0 +1,94 @@
+require "bootstrap-tests"
+
+test.buffer.tear_down = default_tear_down
+
+test.buffer.create = function()
+    local empty = effil.buffer()
+    test.equal(#empty, 0)
+    test.equal(tostring(empty), "")
+
+    local buf = effil.buffer("hello\0world")
+    test.equal(effil.type(buf), "effil.buffer")
+    test.equal(#buf, 11)
+    test.equal(effil.size(buf), 11)
+    test.equal(tostring(buf), "hello\0world")
+    test.is_false(buf:sealed())
+
+    local reserved = effil.buffer(1024)
+    test.equal(#reserved, 0)
+    test.is_false(pcall(effil.buffer, -1))
+    test.is_false(pcall(effil.buffer, 0.5))
+    for _, capacity in ipairs({ 1e30, 2^63, math.huge }) do
+        local ok, err = pcall(effil.buffer, capacity)
+        test.is_false(ok)
+        test.is_not_nil(string.find(err, "effil.buffer: invalid capacity value", 1, true))
+    end
+end
+
+test.buffer.append = function()
+    local buf = effil.buffer(4)
+    test.equal(buf:append("abc"), buf)
+    buf:append("defgh"):append("")
+    test.equal(tostring(buf), "abcdefgh")
+
+    buf:append(effil.buffer("ij"))
+    buf:append(buf)
+    test.equal(tostring(buf), "abcdefghijabcdefghij")
+    test.is_false(pcall(buf.append, buf, 1))
+end
+
+test.buffer.sub = function()
+    local buf = effil.buffer("0123456789")
+    for _, range in ipairs({ {}, {3}, {3, 5}, {-3}, {-3, -2}, {0, 100}, {-100, 2}, {5, 3}, {11} }) do
+        local first, last = range[1], range[2]
+        local slice = buf:sub(first, last)
+        test.equal(tostring(slice), string.sub("0123456789", first or 1, last or -1))
+        test.is_true(slice:sealed())
+    end
+    test.equal(tostring(buf:sub(2, 8):sub(2, -2)), "23456")
+    test.is_false(pcall(buf.sub, buf, "1"))
+end
+
+test.buffer.slices_survive_append = function()
+    local buf = effil.buffer()
+    buf:append("head")
+    local head = buf:sub(1, 4)
+    for i = 1, 100 do
+        buf:append(string.rep("x", i))
+    end
+    test.equal(tostring(head), "head")
+    test.equal(#buf, 4 + 100 * 101 / 2)
+end
+
+test.buffer.seal = function()
+    local buf = effil.buffer("data")
+    test.is_false(pcall(buf.pointer, buf))
+    test.equal(buf:seal(), buf)
+    test.is_true(buf:sealed())
+    test.is_false(pcall(buf.append, buf, "more"))
+    test.equal(effil.type(buf:pointer()), "userdata")
+
+    if jit then
+        local ffi = require "ffi"
+        test.equal(ffi.string(ffi.cast("const char*", buf:pointer()), #buf), "data")
+    end
+end
+
+test.buffer.shared_by_reference = function()
+    local buf = effil.buffer("payload")
+    local chan = effil.channel()
+    local tbl = effil.table{ data = buf }
+
+    local thr = effil.thread(function(data, channel)
+        data:append(" appended")
+        channel:push(data:sub(1, 7))
+    end)(tbl.data, chan)
+    test.equal(thr:wait(), "completed")
+
+    test.equal(tostring(buf), "payload appended")
+    test.equal(tostring(chan:pop()), "payload")
+    test.equal(tbl.data, buf)
+    test.equal(tbl.data, tbl.data)
+    test.not_equal(buf:sub(), buf)
+    test.not_equal(buf, effil.buffer("payload appended"))
+end
@@ -101,3 +101,117 @@ test.dump_table.with_metatable = function()
     test.not_equal(mt2, nil)
     test.equal(mt2.b, 2)
 end
+
+test.dump_table.incremental = function()
+    local tbl = effil.table{ list = {1, 2, 3}, item = { value = 1 }, number = 5 }
+    local dumped = effil.dump(tbl, true)
+
+    -- nothing is changed
+    test.equal(effil.dump(tbl, dumped), dumped)
+
+    -- changed table and tables referring to it are converted again
+    tbl.item.value = 2
+    local refreshed = effil.dump(tbl, dumped)
+    test.not_equal(refreshed, dumped)
+    test.equal(refreshed.list, dumped.list)
+    test.not_equal(refreshed.item, dumped.item)
+    test.equal(refreshed.item.value, 2)
+    test.equal(refreshed.number, 5)
+    -- previous result is kept as is
+    test.equal(dumped.item.value, 1)
+
+    -- removed and added entries
+    tbl.number = nil
+    tbl.list[4] = 4
+    dumped, refreshed = refreshed, effil.dump(tbl, refreshed)
+    test.equal(refreshed.number, nil)
+    test.equal(#refreshed.list, 4)
+    test.equal(refreshed.item, dumped.item)
+
+    -- metatable is a part of the table
+    effil.setmetatable(tbl.item, { kind = "item" })
+    dumped, refreshed = refreshed, effil.dump(tbl, refreshed)
+    test.not_equal(refreshed.item, dumped.item)
+    test.equal(getmetatable(refreshed.item).kind, "item")
+    test.equal(getmetatable(dumped.item), nil)
+
+    effil.getmetatable(tbl.item).kind = "other"
+    refreshed = effil.dump(tbl, refreshed)
+    test.equal(getmetatable(refreshed.item).kind, "other")
+end
+
+test.dump_table.incremental_replaced_table = function()
+    local tbl = effil.table{ item = { value = 1 } }
+    local dumped = effil.dump(tbl, true)
+
+    tbl.item = { value = 1 }
+    collectgarbage()
+    effil.gc.collect()
+    local refreshed = effil.dump(tbl, dumped)
+    test.not_equal(refreshed.item, dumped.item)
+    test.equal(refreshed.item.value, 1)
+end
+
+test.dump_table.incremental_function_upvalues = function()
+    local captured = effil.table{ value = 1 }
+    local tbl = effil.table{ getter = function() return captured.value end }
+    local dumped = effil.dump(tbl, true)
+    test.equal(dumped.getter(), 1)
+
+    -- table is reachable only through upvalue of function
+    captured.value = 2
+    local refreshed = effil.dump(tbl, dumped)
+    test.not_equal(refreshed, dumped)
+    test.equal(refreshed.getter(), 2)
+end
+
+test.dump_table.incremental_reference_loop = function()
+    local tbl = effil.table{ nested = {} }
+    tbl.nested.parent = tbl
+    tbl.other = { nested = tbl.nested }
+    local dumped = effil.dump(tbl, true)
+
+    tbl.nested.value = 1
+    local refreshed = effil.dump(tbl, dumped)
+    test.equal(refreshed.nested.parent, refreshed)
+    test.equal(refreshed.other.nested, refreshed.nested)
+    test.equal(refreshed.nested.value, 1)
+    test.equal(dumped.nested.parent, dumped)
+end
+
+test.dump_table.incremental_foreign_previous = function()
+    local tbl = effil.table{ item = { value = 1 } }
+
+    -- previous table which isn't made by dump is ignored
+    local dumped = effil.dump(tbl, { item = { value = 2 } })
+    test.equal(dumped.item.value, 1)
+
+    -- subtables are reused by dump of other table
+    local other = effil.table{ item = tbl.item }
+    test.equal(effil.dump(other, dumped).item, dumped.item)
+end
+
+test.dump_table.incremental_opt_in = function()
+    local tbl = effil.table{ item = { value = 1 } }
+
+    -- plain dump isn't recorded, so nothing can be reused from it
+    local plain = effil.dump(tbl)
+    local dumped = effil.dump(tbl, plain)
+    test.not_equal(dumped.item, plain.item)
+    test.equal(effil.dump(tbl, dumped).item, dumped.item)
+
+    test.equal(effil.dump(tbl, effil.dump(tbl, true)).item.value, 1)
+    test.is_false(pcall(effil.dump, tbl, false))
+    test.is_false(pcall(effil.dump, tbl, 1))
+end
+
+test.dump_table.incremental_shares_subtables = function()
+    local tbl = effil.table{ item = { value = 1 }, other = {} }
+    local dumped = effil.dump(tbl, true)
+    tbl.other.value = 2
+    local refreshed = effil.dump(tbl, dumped)
+
+    -- unchanged subtables are the same Lua tables in both results
+    dumped.item.value = 3
+    test.equal(refreshed.item.value, 3)
+end
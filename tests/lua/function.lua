@@ -41,3 +41,98 @@ test.func.check_tosting_c_functions = function()
 end
 
 
+
+test.func.function_without_upvalues_is_reused = function()
+    local t = effil.table { func = function(a) return a * 2 end }
+    test.equal(t.func, t.func)
+    test.equal(t.func(21), 42)
+end
+
+test.func.environment_change_is_not_shared = function()
+    local t = effil.table { get = function() return env_value end }
+    env_value = "global"
+    local f = t.get
+    local custom = { env_value = "custom" }
+    if LUA_VERSION > 51 then
+        debug.setupvalue(f, 1, custom)
+    else
+        setfenv(f, custom)
+    end -- LUA_VERSION > 51
+
+    test.equal(f(), "custom")
+    test.equal(t.get(), "global")
+    test.equal(f(), "custom")
+    env_value = nil
+end
+
+test.func.closure_is_new_on_each_load = function()
+    local counter = 0
+    local t = effil.table {
+        inc = function()
+            counter = counter + 1
+            return counter
+        end
+    }
+    local f = t.inc
+    test.equal(f(), 1)
+    local g = t.inc
+    test.not_equal(f, g)
+    test.equal(f(), 2)
+    test.equal(g(), 1)
+end
+
+test.func.recursion_through_shared_table = function()
+    local t = effil.table()
+    local total = 0
+    t.sum = function(n)
+        total = total + n
+        if n > 0 then
+            t.sum(n - 1)
+        end
+        return total
+    end
+    test.equal(t.sum(3), 3)
+end
+
+test.func.upvalues_are_rebound_on_load = function()
+    local counter = 0
+    local shared = effil.table { value = 1 }
+    local t = effil.table {
+        inc = function()
+            counter = counter + shared.value
+            return counter
+        end
+    }
+    test.equal(t.inc(), 1)
+    test.equal(t.inc(), 1)
+
+    shared.value = 5
+    test.equal(t.inc(), 5)
+end
+
+test.func.strip_debug_info = function()
+    test.is_false(effil.strip_functions())
+    test.is_false(effil.strip_functions(true))
+    test.is_true(effil.strip_functions())
+
+    local t = effil.table()
+    t.func = function(a, b) return a .. b end
+    test.equal(t.func("a", "b"), "ab")
+    test.equal(effil.thread(function(f) return f(1, 2) end)(t.func):get(), "12")
+
+    test.is_true(effil.strip_functions(false))
+
+    local ret, err = pcall(effil.strip_functions, 1)
+    test.is_false(ret)
+    test.equal(err, "bad argument #1 to 'effil.strip_functions' (boolean expected, got number)")
+end
+
+test.func.same_body_functions = function()
+    local t = effil.table()
+    for i = 1, 100 do
+        t[i] = function() return i end
+    end
+    for i = 1, 100 do
+        test.equal(t[i](), i)
+    end
+end
@@ -36,6 +36,36 @@ test.gc_stress.create_and_collect_in_parallel = function ()
     end
 end
 
+-- Same as above but objects are collected by incremental steps
+-- while other threads modify them
+test.gc_stress.incremental_create_in_parallel = function ()
+    function worker()
+        effil = require "effil"
+        local shared = effil.table()
+        for i = 1, 20 * tonumber(os.getenv("STRESS")) do
+            for t = 1, 10 do
+                shared[t] = effil.table { nested = effil.table { value = t } }
+                local tmp = effil.table { shared[t] }
+                assert(tmp[1].nested.value == t)
+            end
+            collectgarbage()
+        end
+    end
+
+    local previous = effil.gc.incremental(50)
+    local thread_num = 10
+    local threads = {}
+
+    for i = 1, thread_num do
+        threads[i] = effil.thread(worker)(i)
+    end
+
+    for i = 1, thread_num do
+        test.equal(threads[i]:wait(), "completed")
+    end
+    effil.gc.incremental(previous)
+end
+
 test.gc_stress.regress_for_concurent_thread_creation = function ()
     local a = function() end
     local b = function() end
@@ -54,3 +84,32 @@ test.gc_stress.regress_for_concurent_function_creation = function ()
         effil.thread(function() a() b() end)()
     end
 end
+
+-- Nested objects lookup doesn't take global GC lock,
+-- so readers of t.a.b.c should scale with number of threads
+test.gc_stress.nested_lookup_scaling = function()
+    local t = effil.table { a = { b = { c = 1 } } }
+    local iterations = 100000 * tonumber(os.getenv("STRESS"))
+    local reader = effil.thread(function(t, iterations)
+        local sum = 0
+        for i = 1, iterations do
+            sum = sum + t.a.b.c
+        end
+        return sum
+    end)
+
+    local max_threads = math.max(effil.hardware_threads(), 1)
+    local threads_num = 1
+    while threads_num <= max_threads do
+        local start = os.time()
+        local threads = {}
+        for i = 1, threads_num do
+            threads[i] = reader(t, iterations)
+        end
+        for i = 1, threads_num do
+            test.equal(threads[i]:get(), iterations)
+        end
+        print(string.format("%d readers: %d lookups each in %ds", threads_num, iterations, os.time() - start))
+        threads_num = threads_num * 2
+    end
+end
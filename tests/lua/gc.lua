@@ -56,12 +56,61 @@ test.gc.store_same_value = function()
     c:pop()[1] = 0
 end
 
+test.gc.reclaim_acyclic_immediately = function()
+    collectgarbage()
+    gc.collect()
+    test.equal(gc.count(), 1)
+
+    local t = effil.table { effil.table(), effil.table { effil.table() } }
+    local c = effil.channel()
+    c:push(t[2])
+    test.equal(gc.count(), 6)
+
+    t = nil
+    collectgarbage()
+    -- t[2] is still referenced by channel
+    test.equal(gc.count(), 4)
+
+    c:pop()
+    collectgarbage()
+    test.equal(gc.count(), 2)
+
+    c = nil
+    collectgarbage()
+    test.equal(gc.count(), 1)
+end
+
+test.gc.cycle_is_left_for_tracing = function()
+    local a, b = effil.table(), effil.table()
+    a.b, b.a = b, a
+    a, b = nil, nil
+    collectgarbage()
+    test.equal(gc.count(), 3)
+    gc.collect()
+    test.equal(gc.count(), 1)
+end
+
+test.gc.overwrite_releases_value = function()
+    local t = effil.table()
+    t.key = effil.table()
+    test.equal(gc.count(), 3)
+    t.key = effil.table()
+    collectgarbage()
+    test.equal(gc.count(), 3)
+    t.key = nil
+    collectgarbage()
+    test.equal(gc.count(), 2)
+end
+
 local function create_fabric()
     local f = { data = {} }
 
+    -- tables reference themselves to be deleted by tracing GC only
     function f:create(num)
         for i = 1, num do
-            table.insert(self.data, effil.table())
+            local t = effil.table()
+            t.self = t
+            table.insert(self.data, t)
         end
     end
 
@@ -119,3 +168,71 @@ test.gc.check_step = function()
     fabric:create(1) -- trigger GC
     test.equal(gc.count(), 251)
 end
+
+test.gc.incremental = function()
+    test.equal(gc.incremental(10), 0)
+    test.equal(gc.incremental(), 10)
+
+    -- reachable objects must survive interleaving of marking and mutations
+    local keep = effil.table()
+    local fabric = create_fabric()
+    for i = 1, 100 do
+        keep[i] = effil.table { value = i }
+        fabric:create(20)
+        fabric:remove(15)
+        local tmp = keep[i]
+        keep[i] = nil
+        keep[i] = tmp
+        collectgarbage()
+    end
+    for i = 1, 100 do
+        test.equal(keep[i].value, i)
+    end
+
+    fabric:remove(#fabric.data)
+    collectgarbage()
+    local total = gc.count()
+    for i = 1, 10000 do
+        local tmp = effil.table()
+    end
+    test.is_true(gc.count() < total + 10000)
+
+    test.equal(gc.incremental(0), 10)
+    test.equal(gc.incremental(), 0)
+end
+
+test.gc.incremental_invalid_budget = function()
+    test.is_false(pcall(gc.incremental, -1))
+    test.is_false(pcall(gc.incremental, "1"))
+    test.equal(gc.incremental(), 0)
+end
+
+test.gc.stats = function()
+    local before = gc.stats()
+    test.equal(#before.histogram, 6)
+    test.equal(before.histogram[6].le, math.huge)
+
+    local t = effil.table()
+    t.self = t
+    local c = effil.channel()
+    t, c = nil, nil
+    collectgarbage()
+    gc.collect()
+
+    local after = gc.stats()
+    test.equal(after.collections, before.collections + 1)
+    test.equal(after.reclaimed.table, before.reclaimed.table + 1)
+    test.equal(after.reclaimed.channel, before.reclaimed.channel + 1)
+    test.equal(after.reclaimed_by_refcount, before.reclaimed_by_refcount + 1)
+    test.is_true(after.max_pause >= before.max_pause)
+    test.is_true(after.total_pause >= before.total_pause)
+
+    local function pauses(stats)
+        local count = 0
+        for _, bucket in ipairs(stats.histogram) do
+            count = count + bucket.count
+        end
+        return count
+    end
+    test.equal(pauses(after), pauses(before) + 1)
+end
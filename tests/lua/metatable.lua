@@ -182,6 +182,46 @@ test.shared_table_with_metatable.as_shared_table = function()
     test.equal(share.table_key, "mt_table_value")
 end
 
+test.shared_table_with_metatable.metamethods_update = function()
+    local share = effil.table()
+    local mt = effil.table()
+    local other_mt = effil.table()
+    effil.setmetatable(share, mt)
+
+    -- metamethods appear and disappear while metatable is set
+    test.equal(share.key, nil)
+    mt.__index = function() return "mt" end
+    test.equal(share.key, "mt")
+    mt.__index = nil
+    test.equal(share.key, nil)
+
+    -- metamethods of previous metatable are forgotten
+    mt.__index = function() return "mt" end
+    other_mt.__index = function() return "other_mt" end
+    effil.setmetatable(share, other_mt)
+    test.equal(share.key, "other_mt")
+
+    -- ordinary fields don't enable metamethods
+    effil.setmetatable(share, effil.table{ index = 1, __ = 2, _index = 3 })
+    test.equal(share.key, nil)
+    share.key = 1
+    test.equal(share.key, 1)
+
+    -- metatable shared by several tables
+    local objects = {}
+    for i = 1, 10 do
+        objects[i] = effil.setmetatable(effil.table(), mt)
+    end
+    mt.__newindex = function(t, key, value) effil.rawset(t, key, value * 2) end
+    for i, object in ipairs(objects) do
+        object.value = i
+        test.equal(object.value, i * 2)
+    end
+    mt.__newindex = nil
+    objects[1].value = 1
+    test.equal(objects[1].value, 1)
+end
+
 test.shared_table_with_metatable.metatable_serialization = function()
     local table_with_mt = setmetatable({}, {a=1})
     local tbl = effil.table(table_with_mt)
@@ -0,0 +1,79 @@
+require "bootstrap-tests"
+
+local effil = effil
+
+test.pool_stress.tear_down = default_tear_down
+
+-- Compares latency of short tasks run in pool workers and in new threads
+test.pool_stress.task_latency = function()
+    local tasks = 1000 * tonumber(os.getenv("STRESS"))
+    local job = function(i) return i end
+
+    -- average wall time from submission to result of one task
+    local function measure(run)
+        local total = 0
+        for i = 1, tasks do
+            local start = effil.clock()
+            test.equal(run(i):get(), i)
+            total = total + effil.clock() - start
+        end
+        return total / tasks
+    end
+
+    local runner = effil.thread(job)
+    local thread_time = measure(function(i) return runner(i) end)
+
+    local pool = effil.pool()
+    local pool_time = measure(function(i) return pool:submit(job, i) end)
+
+    print(string.format("%d tasks, average latency: effil.thread %.3fms, effil.pool %.3fms (%d workers)",
+        tasks, thread_time * 1000, pool_time * 1000, pool:size()))
+end
+
+-- Measures throughput of work-stealing scheduler from 1 to effil.hardware_threads() workers
+test.pool_stress.scaling = function()
+    local tasks = 200 * tonumber(os.getenv("STRESS"))
+    local job = function(n)
+        local sum = 0
+        for i = 1, n do
+            sum = sum + i % 7
+        end
+        return sum
+    end
+
+    local max_workers = math.max(effil.hardware_threads(), 1)
+    local workers = 1
+    local single_throughput
+    while workers <= max_workers do
+        local pool = effil.pool(workers)
+        local start = effil.clock()
+        local threads = {}
+        for i = 1, tasks do
+            threads[i] = pool:submit(job, 100000)
+        end
+        for i = 1, tasks do
+            test.equal(threads[i]:wait(), "completed")
+        end
+        local elapsed = effil.clock() - start
+        local throughput = tasks / elapsed
+        single_throughput = single_throughput or throughput
+        print(string.format("%d workers: %d tasks in %.3fs, %.1f tasks/s, speedup %.2f",
+            workers, tasks, elapsed, throughput, throughput / single_throughput))
+        workers = workers < max_workers and math.min(workers * 2, max_workers) or workers + 1
+    end
+end
+
+-- Tasks spawned by worker go to its local deque and are stolen by other workers
+test.pool_stress.nested_submit = function()
+    local pool = effil.pool()
+    local results = effil.table()
+    local fanout = 100 * tonumber(os.getenv("STRESS"))
+
+    pool:submit(function(pool, results, fanout)
+        for i = 1, fanout do
+            pool:submit(function(results, i) results[i] = i end, results, i)
+        end
+    end, pool, results, fanout):wait()
+
+    test.is_true(wait(10, function() return effil.size(results) == fanout end))
+end
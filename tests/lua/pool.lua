@@ -0,0 +1,119 @@
+require "bootstrap-tests"
+
+local effil = effil
+
+test.pool.tear_down = default_tear_down
+
+test.pool.type = function()
+    local pool = effil.pool(2)
+    test.equal(effil.type(pool), "effil.pool")
+    test.equal(pool:size(), 2)
+end
+
+test.pool.default_size = function()
+    test.equal(effil.pool():size(), math.max(effil.hardware_threads(), 1))
+end
+
+test.pool.submit_get = function()
+    local pool = effil.pool(2)
+    local thread = pool:submit(function(a, b) return a + b, a * b end, 3, 4)
+    local sum, product = thread:get()
+    test.equal(sum, 7)
+    test.equal(product, 12)
+    test.equal(thread:status(), "completed")
+end
+
+test.pool.many_tasks = function()
+    local pool = effil.pool(4)
+    local results = effil.table()
+    local threads = {}
+    for i = 1, 100 do
+        threads[i] = pool:submit(function(results, i) results[i] = i * 2 end, results, i)
+    end
+    for i = 1, 100 do
+        test.equal(threads[i]:wait(), "completed")
+        test.equal(results[i], i * 2)
+    end
+end
+
+test.pool.worker_state_is_reset = function()
+    local pool = effil.pool(1)
+    local path = package.path
+    test.equal(pool:submit(function()
+        counter = (counter or 0) + 1
+        string.rep = nil
+        package.loaded.leaked_module = true
+        debug.sethook(function() hooked = true end, "", 1)
+    end):wait(), "completed")
+
+    local counter, rep, module, hooked, task_path = pool:submit(function()
+        return counter, type(string.rep), package.loaded.leaked_module, hooked, package.path
+    end):get()
+    test.is_nil(counter)
+    test.equal(rep, "function")
+    test.is_nil(module)
+    test.is_nil(hooked)
+    test.equal(task_path, path)
+end
+
+test.pool.step = function()
+    local function hook_count()
+        return select(3, debug.gethook()) or 0
+    end
+
+    test.equal(effil.pool(1):submit(hook_count):get(), 200)
+    local pool = effil.pool(1, { step = 50 })
+    test.equal(pool:submit(hook_count):get(), 50)
+    -- hook is set again after reset of worker state
+    test.equal(pool:submit(hook_count):get(), 50)
+    test.equal(effil.pool(1, { step = 0 }):submit(hook_count):get(), 0)
+end
+
+test.pool.failed_task = function()
+    local pool = effil.pool(1)
+    local status, err = pool:submit(function() error("pool error") end):wait()
+    test.equal(status, "failed")
+    test.is_not_nil(string.find(err, "pool error"))
+
+    -- worker survives failure
+    test.equal(pool:submit(function() return "alive" end):get(), "alive")
+end
+
+test.pool.cancel = function()
+    local pool = effil.pool(1)
+    local busy = pool:submit(function() while true do end end)
+    local queued = pool:submit(function() return "unreachable" end)
+
+    test.is_true(busy:cancel())
+    test.equal(busy:status(), "cancelled")
+    test.is_true(queued:cancel())
+    test.equal(queued:status(), "cancelled")
+    test.is_nil(queued:get())
+end
+
+test.pool.wrong_arguments = function()
+    local ret, err = pcall(effil.pool, 0)
+    test.is_false(ret)
+    test.equal(err, "effil.pool: invalid number of workers = 0")
+
+    for _, options in ipairs({ 1, { step = -1 }, { step = 1.5 }, { step = "many" } }) do
+        test.is_false(pcall(effil.pool, 1, options))
+    end
+
+    ret, err = pcall(function() effil.pool(1):submit("function") end)
+    test.is_false(ret)
+    test.is_not_nil(string.find(err, "function expected, got string", 1, true))
+end
+
+test.pool.store_in_table = function()
+    local tbl = effil.table { pool = effil.pool(1) }
+    test.equal(tbl.pool:submit(function() return 42 end):get(), 42)
+end
+
+test.pool.submit_from_worker = function()
+    local pool = effil.pool(2)
+    local inner = pool:submit(function(pool)
+        return pool:submit(function() return effil.thread_id() end)
+    end, pool):get()
+    test.is_string(inner:get())
+end
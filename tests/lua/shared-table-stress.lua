@@ -0,0 +1,182 @@
+require "bootstrap-tests"
+
+local effil = effil
+
+test.shared_table_stress.tear_down = default_tear_down
+
+-- Throughput of get/set with a lot of string keys.
+-- Plain Lua table is measured as a baseline
+test.shared_table_stress.string_keys = function()
+    local count = 1000000
+    local keys = {}
+    for i = 1, count do
+        keys[i] = "key_" .. i
+    end
+
+    local function measure(tbl)
+        local start = os.clock()
+        for i = 1, count do
+            tbl[keys[i]] = i
+        end
+        local set_time = os.clock() - start
+
+        start = os.clock()
+        for i = 1, count do
+            assert(tbl[keys[i]] == i)
+        end
+        return set_time, os.clock() - start
+    end
+
+    local lua_set, lua_get = measure({})
+    local shared_set, shared_get = measure(effil.table())
+
+    print(string.format("%d string keys: lua table set %.3fs get %.3fs, effil.table set %.3fs get %.3fs",
+        count, lua_set, lua_get, shared_set, shared_get))
+end
+
+-- Length and ipairs of long work list are served by array part
+test.shared_table_stress.work_list = function()
+    local count = 100000
+    local list = effil.table()
+
+    local start = os.clock()
+    for i = 1, count do
+        list[#list + 1] = i
+    end
+    local append_time = os.clock() - start
+    test.equal(#list, count)
+
+    start = os.clock()
+    local sum = 0
+    for _, v in effil.ipairs(list) do
+        sum = sum + v
+    end
+    local ipairs_time = os.clock() - start
+    test.equal(sum, count * (count + 1) / 2)
+
+    start = os.clock()
+    while #list > 0 do
+        list[#list] = nil
+    end
+    local pop_time = os.clock() - start
+
+    print(string.format("%d items work list: append %.3fs, ipairs %.3fs, pop %.3fs",
+        count, append_time, ipairs_time, pop_time))
+end
+
+-- Threads update different keys of one big table.
+-- Sharded table is compared with the regular one
+test.shared_table_stress.contention = function()
+    local count = 200000
+
+    local writer = effil.thread(function(t, id, count)
+        for i = 1, count do
+            local key = "key_" .. id .. "_" .. i
+            t[key] = i
+            assert(t[key] == i)
+        end
+        return count
+    end)
+
+    local function measure(t, threads_num)
+        local start = os.time()
+        local threads = {}
+        for i = 1, threads_num do
+            threads[i] = writer(t, i, count)
+        end
+        for i = 1, threads_num do
+            test.equal(threads[i]:get(), count)
+        end
+        test.equal(effil.size(t), threads_num * count)
+        return os.time() - start
+    end
+
+    local threads_num = math.max(effil.hardware_threads(), 2)
+    print(string.format("%d writers: %d keys each, regular table %ds, 64 shards %ds", threads_num, count,
+        measure(effil.table(), threads_num), measure(effil.table({}, { shards = 64 }), threads_num)))
+end
+
+-- Readers and writers hammer the same keys of one table.
+-- os.clock() is CPU time of the whole process, so it shows time burnt by waiting threads
+test.shared_table_stress.readers_writers = function()
+    local iterations = 100000
+    local t = effil.table({ counter = 0 })
+
+    local reader = effil.thread(function(t, iterations)
+        local sum = 0
+        for _ = 1, iterations do
+            sum = sum + t.counter
+        end
+        return sum
+    end)
+
+    local writer = effil.thread(function(t, iterations)
+        for i = 1, iterations do
+            t.counter = i
+        end
+        return iterations
+    end)
+
+    local threads_num = math.max(effil.hardware_threads(), 2) * 2
+    local wall_start, cpu_start = effil.clock(), os.clock()
+    local threads = {}
+    for i = 1, threads_num do
+        threads[i] = (i % 4 == 0 and writer or reader)(t, iterations)
+    end
+    for i = 1, threads_num do
+        test.equal(type(threads[i]:get()), "number")
+    end
+    print(string.format("%d threads (1/4 writers): %d accesses each in %.3fs, CPU time %.3fs",
+        threads_num, iterations, effil.clock() - wall_start, os.clock() - cpu_start))
+end
+
+test.shared_table_stress.pairs = function()
+    local count = 1000000
+    local t = effil.table()
+    for i = 1, count do
+        t["key" .. i] = i
+    end
+
+    local function traverse(options)
+        local start = os.clock()
+        local visited = 0
+        for _ in effil.pairs(t, options) do
+            visited = visited + 1
+        end
+        test.equal(visited, count)
+        return os.clock() - start
+    end
+
+    print(string.format("%d entries: pairs %.3fs, snapshot pairs %.3fs",
+        count, traverse(), traverse({ snapshot = true })))
+end
+
+test.shared_table_stress.incremental_dump = function()
+    local tables, entries = 1000, 100
+    local t = effil.table()
+    for i = 1, tables do
+        local sub = {}
+        for j = 1, entries do
+            sub["key" .. j] = j
+        end
+        t[i] = sub
+    end
+
+    local start = os.clock()
+    local dumped = effil.dump(t, true)
+    local full = os.clock() - start
+
+    start = os.clock()
+    local iterations = 100
+    for i = 1, iterations do
+        t[i].key1 = -i
+        dumped = effil.dump(t, dumped)
+    end
+    local refresh = (os.clock() - start) / iterations
+
+    for i = 1, iterations do
+        test.equal(dumped[i].key1, -i)
+    end
+    print(string.format("%d tables of %d entries: full dump %.4fs, refresh of one table %.4fs",
+        tables, entries, full, refresh))
+end
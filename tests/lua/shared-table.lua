@@ -99,3 +99,400 @@ test.shared_table.global = function ()
     test.equal(status, "completed")
     test.equal(effil.G.test_key, "checked")
 end
+
+test.shared_table.many_keys = function ()
+    local share = effil.table()
+    local count = 10000
+    for i = 1, count do
+        share["key" .. i] = i
+        share[i * 1024] = i
+    end
+    test.equal(effil.size(share), count * 2)
+    for i = 1, count do
+        test.equal(share["key" .. i], i)
+        test.equal(share[i * 1024], i)
+    end
+
+    for i = 1, count, 2 do
+        share["key" .. i] = nil
+    end
+    test.equal(effil.size(share), count * 3 / 2)
+    for i = 1, count do
+        test.equal(share["key" .. i], i % 2 == 0 and i or nil)
+    end
+end
+
+test.shared_table.remove_while_iterating = function ()
+    local share = effil.table()
+    for i = 1, 100 do
+        share["key" .. i] = i
+    end
+
+    local visited = 0
+    local key, value = effil.next(share)
+    while key do
+        visited = visited + 1
+        test.equal(share[key], value)
+        share[key] = nil
+        key, value = effil.next(share, key)
+    end
+    test.equal(visited, 100)
+    test.equal(effil.size(share), 0)
+
+    -- removed entry is reused by the same key
+    share.key = 1
+    share.key = nil
+    share.key = 2
+    test.equal(share.key, 2)
+    test.equal(effil.size(share), 1)
+end
+
+test.shared_table.array_part = function ()
+    local share = effil.table()
+    -- keys are stored out of order and moved to array part later
+    for i = 10, 1, -1 do
+        share[i] = i
+    end
+    test.equal(#share, 10)
+    test.equal(effil.size(share), 10)
+
+    share[5] = nil
+    test.equal(#share, 4)
+    share[5] = 5
+    test.equal(#share, 10)
+
+    share[10] = nil
+    share[9] = nil
+    test.equal(#share, 8)
+    share[9] = 9
+    test.equal(#share, 9)
+
+    local count = 0
+    for i, v in effil.ipairs(share) do
+        test.equal(i, v)
+        count = count + 1
+    end
+    test.equal(count, 9)
+
+    share.key = "value"
+    local visited = {}
+    for k, v in effil.pairs(share) do
+        visited[k] = v
+    end
+    for i = 1, 9 do
+        test.equal(visited[i], i)
+    end
+    test.equal(visited.key, "value")
+end
+
+test.shared_table.clear_while_iterating = function ()
+    local share = effil.table { 1, 2, 3, a = 1, b = 2 }
+    local visited = 0
+    for k in effil.pairs(share) do
+        visited = visited + 1
+        share[k] = nil
+    end
+    test.equal(visited, 5)
+    test.equal(effil.size(share), 0)
+    test.equal(#share, 0)
+end
+
+test.shared_table.lookup_by_any_key = function ()
+    local subtable = effil.table()
+    local channel = effil.channel()
+    local keys = { true, false, 1, 2.5, -3, 2^40, "", "key", "k\0ey", subtable, channel }
+
+    local share = effil.table()
+    for i, key in ipairs(keys) do
+        share[key] = i
+    end
+    test.equal(effil.size(share), #keys)
+
+    for i, key in ipairs(keys) do
+        test.equal(share[key], i)
+        test.equal(effil.rawget(share, key), i)
+    end
+    test.is_nil(share["k"])
+    test.is_nil(share[2.25])
+    test.is_nil(share[effil.table()])
+
+    local visited = 0
+    local key, value = effil.next(share)
+    while key ~= nil do
+        test.equal(keys[value], key)
+        visited = visited + 1
+        key, value = effil.next(share, key)
+    end
+    test.equal(visited, #keys)
+end
+
+test.shared_table.string_sizes = function ()
+    local share = effil.table()
+    local strings = {}
+    for _, size in ipairs({ 0, 1, 13, 14, 15, 16, 100, 10000 }) do
+        local str = string.rep("s", size)
+        strings[#strings + 1] = str
+        share[str] = str .. "!"
+    end
+
+    for _, str in ipairs(strings) do
+        test.equal(share[str], str .. "!")
+        test.equal(effil.rawget(share, str), str .. "!")
+    end
+    test.equal(effil.size(share), #strings)
+
+    local channel = effil.channel()
+    channel:push(strings[5], strings[8])
+    local short, long = channel:pop()
+    test.equal(short, strings[5])
+    test.equal(long, strings[8])
+end
+
+test.shared_table.interned_keys = function ()
+    local key = "rather long name of field"
+    local before = effil.gc.stats().interned_strings
+
+    local first, second = effil.table(), effil.table()
+    first[key] = 1
+    second[key] = 2
+    second[key .. "!"] = 3
+    test.equal(effil.gc.stats().interned_strings, before + 2)
+
+    -- values and short keys are not interned
+    first.value = string.rep("v", 100)
+    first.short = key
+    test.equal(effil.gc.stats().interned_strings, before + 2)
+
+    test.equal(first[key], 1)
+    test.equal(second[key], 2)
+    test.equal(second[key .. "!"], 3)
+    test.equal(first.short, key)
+end
+
+test.shared_table.sharded = function ()
+    test.equal(pcall(effil.table, {}, 1), false)
+    test.equal(pcall(effil.table, {}, { shards = 0 }), false)
+    test.equal(pcall(effil.table, {}, { shards = 1.5 }), false)
+    test.equal(pcall(effil.table, {}, { shards = "many" }), false)
+
+    local share = effil.table({ 1, 2, 3, key = "value", nested = { 4 } }, { shards = 8 })
+    test.equal(effil.size(share), 5)
+    test.equal(#share, 3)
+    test.equal(share.key, "value")
+    test.equal(share.nested[1], 4)
+
+    for i = 4, 100 do
+        share[i] = i
+    end
+    test.equal(#share, 100)
+    share[50] = nil
+    local length = #share
+    test.is_true(length == 49 or length == 100)
+
+    local count = 0
+    for i, v in effil.ipairs(share) do
+        test.equal(i, v)
+        count = count + 1
+    end
+    test.equal(count, 49)
+
+    local visited = {}
+    for k, v in effil.pairs(share) do
+        visited[k] = v
+        share[k] = nil
+    end
+    test.equal(visited.key, "value")
+    test.equal(visited[100], 100)
+    test.is_nil(visited[50])
+    test.equal(effil.size(share), 0)
+
+    effil.setmetatable(share, { __index = function(t, key) return key .. "!" end })
+    test.equal(share.missing, "missing!")
+
+    local self_ref = {}
+    self_ref.self = self_ref
+    local shared_self = effil.table(self_ref, { shards = 4 })
+    test.equal(shared_self.self, shared_self)
+end
+
+test.shared_table.get_set_many = function ()
+    local record = effil.table({ name = "John", [1] = "first" })
+    effil.setmetatable(record, { __index = function() return "default" end })
+
+    test.equal(effil.set_many(record, { age = 42, city = "Paris", [2] = "second", nested = { 1, 2 } }), record)
+    test.equal(record.age, 42)
+    test.equal(record[2], "second")
+    test.equal(record.nested[2], 2)
+
+    local values = effil.get_many(record, { "name", "age", 1, "missing", "nested" })
+    test.equal(type(values), "table")
+    test.equal(values.name, "John")
+    test.equal(values.age, 42)
+    test.equal(values[1], "first")
+    test.is_nil(values.missing) -- metatable is not used
+    test.equal(values.nested, record.nested)
+
+    local key = effil.table()
+    effil.set_many(record, { [key] = "table key" })
+    test.equal(effil.get_many(record, { key })[key], "table key")
+    test.equal(next(effil.get_many(record, {})), nil)
+
+    local sharded = effil.table({}, { shards = 4 })
+    local entries, keys = {}, {}
+    for i = 1, 100 do
+        entries["key" .. i] = i
+        keys[i] = "key" .. i
+    end
+    effil.set_many(sharded, entries)
+    test.equal(effil.size(sharded), 100)
+    values = effil.get_many(sharded, keys)
+    for i = 1, 100 do
+        test.equal(values["key" .. i], i)
+    end
+end
+
+test.shared_table.atomic = function ()
+    local t = effil.table({ counter = 10, name = "value" })
+    effil.setmetatable(t, { __index = function() return 100 end })
+
+    test.equal(effil.atomic.add(t, "counter", 5), 15)
+    test.equal(effil.atomic.add(t, "counter", -20), -5)
+    test.equal(effil.atomic.add(t, "absent"), 1)
+    test.equal(effil.atomic.add(t, "float", 0.5), 0.5)
+    test.equal(t.counter, -5)
+    test.equal(pcall(effil.atomic.add, t, "name", 1), false)
+    test.equal(pcall(effil.atomic.add, t, "counter", "1"), false)
+    test.equal(pcall(effil.atomic.add, {}, "counter", 1), false)
+
+    test.equal(effil.atomic.exchange(t, "name", "other"), "value")
+    test.equal(effil.atomic.exchange(t, "name", nil), "other")
+    test.is_nil(effil.rawget(t, "name"))
+    test.is_nil(effil.atomic.exchange(t, "name", "again"))
+
+    test.is_false(effil.atomic.compare_and_swap(t, "once", 1, "first"))
+    test.is_true(effil.atomic.compare_and_swap(t, "once", nil, "first"))
+    test.is_false(effil.atomic.compare_and_swap(t, "once", nil, "second"))
+    test.equal(t.once, "first")
+    test.is_true(effil.atomic.compare_and_swap(t, "counter", -5, { 1 }))
+    test.equal(t.counter[1], 1)
+    test.is_true(effil.atomic.compare_and_swap(t, "counter", t.counter, nil))
+    test.is_nil(effil.rawget(t, "counter"))
+
+    test.equal(effil.atomic.fetch_or(t, "flags", 1), 0)
+    test.equal(effil.atomic.fetch_or(t, "flags", 4), 1)
+    test.equal(effil.atomic.fetch_xor(t, "flags", 1), 5)
+    test.equal(effil.atomic.fetch_and(t, "flags", 6), 4)
+    test.equal(t.flags, 4)
+    test.equal(pcall(effil.atomic.fetch_or, t, "flags", 0.5), false)
+    test.equal(pcall(effil.atomic.fetch_or, t, "once", 1), false)
+end
+
+test.shared_table.atomic_counter = function ()
+    local t = effil.table({ counter = 0 })
+    local increment = effil.thread(function(t, count)
+        local effil = require "effil"
+        for _ = 1, count do
+            effil.atomic.add(t, "counter")
+        end
+    end)
+
+    local threads = {}
+    for i = 1, 4 do
+        threads[i] = increment(t, 1000)
+    end
+    for i = 1, 4 do
+        test.equal(threads[i]:wait(), "completed")
+    end
+    test.equal(t.counter, 4000)
+end
+
+test.shared_table.pairs_cursor = function ()
+    local share = effil.table({ 1, 2, 3 })
+    for i = 1, 100 do
+        share["key" .. i] = i
+    end
+
+    -- two traversals of the same table don't interfere
+    local outer, inner = 0, 0
+    for k in effil.pairs(share) do
+        outer = outer + 1
+        if outer == 50 then
+            for _ in effil.pairs(share) do
+                inner = inner + 1
+            end
+        end
+    end
+    test.equal(outer, 103)
+    test.equal(inner, 103)
+
+    -- iteration is continued from any key, not only from the last returned one
+    local first = effil.next(share)
+    local second = effil.next(share, first)
+    effil.next(share, second)
+    test.equal(effil.next(share, first), second)
+end
+
+test.shared_table.pairs_snapshot = function ()
+    local share = effil.table({ 1, 2, 3, key = "value", nested = {} }, { shards = 4 })
+    local visited = {}
+    local count = 0
+    for k, v in effil.pairs(share, { snapshot = true }) do
+        visited[k] = v
+        count = count + 1
+        -- snapshot doesn't see modifications
+        share.added = true
+        share[1] = nil
+    end
+    test.equal(count, 5)
+    test.equal(visited[1], 1)
+    test.equal(visited[3], 3)
+    test.equal(visited.key, "value")
+    test.equal(effil.type(visited.nested), "effil.table")
+    test.is_nil(visited.added)
+
+    for _ in effil.pairs(effil.table(), { snapshot = true }) do
+        test.is_true(false)
+    end
+    test.equal(pcall(effil.pairs, share, "snapshot"), false)
+end
+
+test.shared_table.freeze = function ()
+    local config = effil.table({ workers = 4, hosts = { "a", "b" }, [1] = "first" })
+    effil.setmetatable(config, { __index = function(t, key) return key .. "?" end })
+    config.self = config
+
+    test.equal(effil.freeze(config), config)
+    test.equal(config.workers, 4)
+    test.equal(config.hosts[2], "b")
+    test.equal(config.missing, "missing?")
+    test.equal(#config, 1)
+    test.equal(effil.size(config), 4)
+    test.equal(effil.get_many(config, { "workers" }).workers, 4)
+    local count = 0
+    for _ in effil.pairs(config) do
+        count = count + 1
+    end
+    test.equal(count, 4)
+
+    test.equal(pcall(function() config.workers = 8 end), false)
+    test.equal(pcall(function() config.workers = nil end), false)
+    test.equal(pcall(function() config.hosts[3] = "c" end), false)
+    test.equal(pcall(function() effil.getmetatable(config).__index = nil end), false)
+    test.equal(pcall(effil.rawset, config, "new", 1), false)
+    test.equal(pcall(effil.set_many, config, { new = 1 }), false)
+    test.equal(pcall(effil.atomic.add, config, "workers"), false)
+    test.equal(pcall(effil.setmetatable, config, nil), false)
+    test.equal(config.workers, 4)
+    test.is_nil(effil.rawget(config, "new"))
+
+    -- frozen tables are read from other threads
+    local reader = effil.thread(function(config)
+        return config.hosts[1] .. config.workers
+    end)
+    test.equal(reader(config):get(), "a4")
+
+    -- table stored in frozen table is frozen too
+    local other = effil.table()
+    effil.freeze(effil.table({ nested = other }))
+    test.equal(pcall(function() other.key = 1 end), false)
+end
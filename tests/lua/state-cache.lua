@@ -0,0 +1,89 @@
+require "bootstrap-tests"
+
+local effil = effil
+local cache = effil.state_cache
+
+test.state_cache.tear_down = function()
+    cache.capacity(0)
+    default_tear_down()
+end
+
+test.state_cache.disabled_by_default = function()
+    test.equal(cache.capacity(), 0)
+    test.equal(cache.count(), 0)
+end
+
+test.state_cache.capacity = function()
+    test.equal(cache.capacity(4), 0)
+    test.equal(cache.capacity(), 4)
+    test.is_true(wait(5, function() return cache.count() == 4 end))
+
+    test.equal(cache.capacity(1), 4)
+    test.equal(cache.count(), 1)
+
+    local ret, err = pcall(cache.capacity, -1)
+    test.is_false(ret)
+    test.equal(err, "effil.state_cache.capacity: invalid capacity value = -1")
+end
+
+test.state_cache.hits_and_misses = function()
+    cache.capacity(2)
+    test.is_true(wait(5, function() return cache.count() == 2 end))
+
+    local before = cache.stats()
+    test.equal(effil.thread(function() return 1 end)():get(), 1)
+    local after = cache.stats()
+
+    test.equal(after.hits, before.hits + 1)
+    test.equal(after.misses, before.misses)
+    test.equal(after.capacity, 2)
+end
+
+test.state_cache.recycled_state_is_clean = function()
+    cache.capacity(1)
+    test.is_true(wait(5, function() return cache.count() == 1 end))
+
+    local runner = effil.thread(function(arg)
+        local prev = leaked_global
+        leaked_global = arg
+        string = nil
+        return prev
+    end)
+    test.is_nil(runner(effil.table()):get())
+    test.is_true(cache.stats().recycled > 0)
+    test.is_nil(runner(effil.table()):get())
+    test.equal(effil.thread(function() return type(string) end)():get(), "table")
+end
+
+test.state_cache.recycled_state_restores_libraries = function()
+    cache.capacity(1)
+    test.is_true(wait(5, function() return cache.count() == 1 end))
+
+    -- checks that libraries are intact and then spoils them
+    local runner = effil.thread(function()
+        local tbl = {}
+        table.insert(tbl, 1)
+        local gc_ok, gc_running = pcall(collectgarbage, "isrunning")
+        local clean = string.rep("a", 2) == "aa" and tbl[1] == 1 and math.pi == math.acos(-1)
+            and math.extra == nil and getmetatable(os) == nil and ("abc"):upper() == "ABC"
+            and not pcall(function() return "a" + "b" end)
+            and not pcall(function() return (1).field end)
+            and not pcall(function() return (nil).field end)
+            and (not gc_ok or gc_running)
+
+        string.rep = nil
+        table.insert = function() error("spoiled") end
+        math.pi = 3
+        math.extra = true
+        setmetatable(os, {})
+        getmetatable("").__index = {}
+        getmetatable("").__add = function() return "spoiled" end
+        debug.setmetatable(0, { __index = function() return "spoiled" end })
+        debug.setmetatable(nil, { __index = function() return "spoiled" end })
+        collectgarbage("stop")
+        return clean
+    end)
+    test.is_true(runner():get())
+    test.is_true(cache.stats().recycled > 0)
+    test.is_true(runner():get())
+end
@@ -8,6 +8,14 @@ test.thread.hardware_threads = function()
     test.is_true(effil.hardware_threads() >= 0)
 end
 
+test.thread.clock = function()
+    local start = effil.clock()
+    effil.sleep(100, "ms")
+    local elapsed = effil.clock() - start
+    test.is_true(elapsed >= 0.09)
+    test.is_true(elapsed < 10)
+end
+
 test.thread.runner_is_serializible = function ()
     local table = effil.table()
     local runner = effil.thread(function(n) return n * 2 end)
@@ -535,3 +543,79 @@ test.thread.check_effil_pcall_with_cancel_thread = function()
     test.is_true(thr:cancel())
     test.equal(thr:wait(), "cancelled")
 end
+
+test.thread.wait_any = function()
+    local runner = effil.thread(function(delay)
+        effil.sleep(delay, "ms")
+        return delay
+    end)
+    local threads = { runner(3000), runner(100), runner(3000) }
+
+    test.equal(effil.wait_any(threads), 2)
+    test.equal(threads[2]:status(), "completed")
+    test.is_nil(effil.wait_any({ threads[1] }, 0))
+
+    for _, thread in ipairs(threads) do
+        thread:cancel()
+    end
+end
+
+test.thread.wait_all = function()
+    local runner = effil.thread(function(delay)
+        effil.sleep(delay, "ms")
+    end)
+    local threads = {}
+    for i = 1, 8 do
+        threads[i] = runner(i * 50)
+    end
+
+    test.is_false(effil.wait_all({ runner(3000), threads[1] }, 100, "ms"))
+    test.is_true(effil.wait_all(threads))
+    for _, thread in ipairs(threads) do
+        test.equal(thread:status(), "completed")
+    end
+    test.is_true(effil.wait_all({}))
+end
+
+test.thread.wait_any_wrong_arguments = function()
+    local ret, err = pcall(effil.wait_any, { 1 })
+    test.is_false(ret)
+    test.equal(err, "bad argument #1 to 'effil.wait_any' (effil.thread expected at index 1, got number)")
+end
+
+test.thread.and_then = function()
+    local thread = effil.thread(function(a, b) return a + b end)(1, 2)
+    local continuation = thread:and_then(function(sum) return sum * 10 end)
+    test.equal(continuation:get(), 30)
+
+    -- continuation of finished thread starts immediately
+    test.equal(thread:and_then(function(sum) return sum end):get(), 3)
+end
+
+test.thread.and_then_keeps_step = function()
+    local function hook_count()
+        return select(3, debug.gethook()) or 0
+    end
+
+    local runner = effil.thread(hook_count)
+    runner.step = 50
+    local thread = runner()
+    test.equal(thread:get(), 50)
+    test.equal(thread:and_then(hook_count):get(), 50)
+    test.equal(thread:and_then(hook_count):and_then(hook_count):get(), 50)
+
+    runner.step = 0
+    thread = runner()
+    test.equal(thread:get(), 0)
+    test.equal(thread:and_then(hook_count):get(), 0)
+
+    local pool = effil.pool(1, { step = 70 })
+    test.equal(pool:submit(function() end):and_then(hook_count):get(), 70)
+end
+
+test.thread.and_then_failure = function()
+    local thread = effil.thread(function() error("first failed") end)()
+    local status, err = thread:and_then(function() return "unreachable" end):wait()
+    test.equal(status, "failed")
+    test.is_not_nil(string.find(err, "first failed"))
+end
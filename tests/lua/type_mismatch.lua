@@ -75,7 +75,7 @@ local function generate_tests()
     thread:wait()
     local lua_thread = coroutine.create(func)
 
-    local all_types = { 22, "s", true, {}, stable, func, thread, effil.channel(), lua_thread }
+    local all_types = { 22, "s", true, {}, stable, func, thread, effil.channel(), effil.array("f64", 1), effil.buffer("s"), lua_thread }
 
     for _, type_instance in ipairs(all_types) do
         local typename = effil.type(type_instance)
@@ -96,12 +96,23 @@ local function generate_tests()
             test.type_mismatch.input_types_mismatch_p(1, "effil.table", "rawset", type_instance, 44, 22)
             -- effil.rawget
             test.type_mismatch.input_types_mismatch_p(1, "effil.table", "rawget", type_instance, 44)
+            -- effil.get_many
+            test.type_mismatch.input_types_mismatch_p(1, "effil.table", "get_many", type_instance, {})
+            -- effil.set_many
+            test.type_mismatch.input_types_mismatch_p(1, "effil.table", "set_many", type_instance, {})
             -- effil.ipairs
             test.type_mismatch.input_types_mismatch_p(1, "effil.table", "ipairs", type_instance)
             -- effil.pairs
             test.type_mismatch.input_types_mismatch_p(1, "effil.table", "pairs", type_instance)
         end
 
+        if typename ~= "table" then
+            -- effil.get_many
+            test.type_mismatch.input_types_mismatch_p(2, "table", "get_many", stable, type_instance)
+            -- effil.set_many
+            test.type_mismatch.input_types_mismatch_p(2, "table", "set_many", stable, type_instance)
+        end
+
         -- effil.thread
         if typename ~= "function" then
             test.type_mismatch.input_types_mismatch_p(1, "function", "thread", type_instance)
@@ -113,16 +124,25 @@ local function generate_tests()
         end
         if typename ~= "string" then
             test.type_mismatch.input_types_mismatch_p(2, "string", "sleep", 1, type_instance)
+            -- effil.array
+            test.type_mismatch.input_types_mismatch_p(1, "string", "array", type_instance, 1)
         end
 
         if typename ~= "number" then
             -- effil.channel
             test.type_mismatch.input_types_mismatch_p(1, "number", "channel", type_instance)
+            -- effil.array
+            test.type_mismatch.input_types_mismatch_p(2, "number", "array", "f64", type_instance)
 
             --  effil.gc.step
             test.type_mismatch.input_types_mismatch_p(1, "number", "gc.step", type_instance)
         end
 
+        -- effil.buffer
+        if typename ~= "string" and typename ~= "number" then
+            test.type_mismatch.input_types_mismatch_p(1, "string or number", "buffer", type_instance)
+        end
+
         -- effil.dump
         if typename ~= "table" and typename ~= "effil.table" then
             test.type_mismatch.input_types_mismatch_p(1, "table", "dump", type_instance)